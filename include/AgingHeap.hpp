@@ -0,0 +1,194 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include <BucketQueue.hpp>
+#include <DaryHeap.hpp>
+
+// A priority heap whose entries gain priority the longer they wait...
+//
+// Under a steady stream of high priority work, a plain priority queue never
+// gets around to the low priority entries.  They pile up and then all drain
+// at once when the load lets go.  Here an entry's effective priority is its
+// level plus one for every AgeMs it's been waiting, so anything waits at most
+// about (Levels - 1) * AgeMs behind newer work before it comes out.
+//
+// None of that costs a re-heapify.  Comparing two entries' effective
+// priorities at any given moment:
+//
+//     levelA + (now - pushedA) / age   vs.   levelB + (now - pushedB) / age
+//
+// now cancels out, leaving (level * age - pushed) as a key fixed at push time.
+// The heap orders on that key and never has to be touched as time passes.
+// Keys are 64 bit nanoseconds since the queue was made, which won't wrap for
+// a few centuries, so there's no rebasing to do either.  Within a level that
+// also makes it FIFO.
+//
+// You don't normally use this directly- give TSPriorityQueue an AgingLevels
+// where the Compare would go:
+//
+//     TSPriorityQueue<Job, 0, AgingLevels<8, 250, JobLevel>> queue;
+//
+// Every entry popped is counted against its level's TSPriorityWaitStats, so
+// you can see what the wait at each level actually is.
+
+// Selects an AgingHeap with Levels priority levels (0 lowest) for
+// TSPriorityQueue, where waiting AgeMs milliseconds is worth one level.
+// Level(item) gives an item's level; anything past the top counts as the
+// top level.
+template <size_t Levels, size_t AgeMs, typename Level = ItemLevel> struct AgingLevels
+{
+    static_assert(Levels > 0, "AgingLevels needs at least one level");
+    static_assert(AgeMs > 0, "AgingLevels needs a non-zero age per level");
+};
+
+// How long entries at one priority level waited between push and pop.
+struct TSPriorityWaitStats
+{
+    uint64_t count = 0;                         // Entries popped
+    std::chrono::nanoseconds total{0};          // Sum of their waits
+    std::chrono::nanoseconds longest{0};        // Worst single wait
+
+    std::chrono::nanoseconds mean() const       { return (count > 0) ? (total / int64_t(count)) : std::chrono::nanoseconds(0); };
+};
+
+template <typename T, size_t Levels, size_t AgeMs, typename Level = ItemLevel, size_t Capacity = 0> class AgingHeap {
+    private:
+        struct Entry
+        {
+            template <typename... Args> Entry(int64_t entryKey, int64_t pushedAt, size_t entryLevel, Args&&... args) :
+                key(entryKey), pushed(pushedAt), level(entryLevel), item(std::forward<Args>(args)...) {};
+
+            int64_t key;                        // level * age - pushed; bigger comes out first
+            int64_t pushed;                     // Nanoseconds since m_start
+            size_t level;
+            T item;
+        };
+
+        struct ByKey
+        {
+            bool operator()(const Entry& a, const Entry& b) const { return a.key < b.key; };
+        };
+
+        typedef DaryHeap<Entry, ByKey, Capacity> Heap;
+
+    public:
+        typedef typename Heap::Handle Handle;
+
+        AgingHeap() : m_start(std::chrono::steady_clock::now()) {};
+
+        AgingHeap(const AgingHeap&) = delete;
+        AgingHeap& operator=(const AgingHeap&) = delete;
+
+        Handle push(const T& item)                  { return emplace(item); };
+        Handle push(T&& item)                       { return emplace(std::move(item)); };
+        template <typename... Args> Handle emplace(Args&&... args)
+        {
+            // Build the item first; we need it to work out its level.
+            T item(std::forward<Args>(args)...);
+            int64_t pushed = now();
+            size_t level = levelOf(item);
+            return m_heap.emplace(keyOf(level, pushed), pushed, level, std::move(item));
+        };
+
+        const T& top() const                        { return m_heap.top().item; };
+
+        /// Moves the top entry out and removes it, counting its wait.
+        T take()
+        {
+            Entry entry = m_heap.take();
+            record(entry);
+            return std::move(entry.item);
+        };
+
+        void pop()
+        {
+            record(m_heap.top());
+            m_heap.pop();
+        };
+
+        bool contains(const Handle& handle) const   { return m_heap.contains(handle); };
+
+        /// Replaces the value of handle's entry.  It keeps the age it's
+        /// built up; only its level changes.  Returns false if the handle
+        /// is stale.
+        bool update(const Handle& handle, const T& item)
+        {
+            const Entry *entry = m_heap.find(handle);
+            if (entry == NULL)
+            {
+                return false;
+            }
+            size_t level = levelOf(item);
+            return m_heap.update(handle, Entry(keyOf(level, entry->pushed), entry->pushed, level, item));
+        };
+
+        bool erase(const Handle& handle)            { return m_heap.erase(handle); };
+
+        /// Swaps item in for the entry with the lowest effective priority,
+        /// if item outranks it.  Returns the new entry's handle, which is
+        /// not valid() if item was the one that lost.
+        Handle replace_lowest(const T& item)
+        {
+            int64_t pushed = now();
+            size_t level = levelOf(item);
+            return m_heap.replace_lowest(Entry(keyOf(level, pushed), pushed, level, item));
+        };
+
+        bool empty() const                          { return m_heap.empty(); };
+        size_t size() const                         { return m_heap.size(); };
+
+        /// Wait statistics for one level.
+        TSPriorityWaitStats wait_stats(size_t level) const
+        {
+            return (level < Levels) ? m_stats[level] : TSPriorityWaitStats();
+        };
+
+        /// Starts the wait statistics over.
+        void reset_wait_stats()
+        {
+            for (size_t i = 0; i < Levels; i++)
+            {
+                m_stats[i] = TSPriorityWaitStats();
+            }
+        };
+
+    private:
+        static constexpr int64_t AgeNs = int64_t(AgeMs) * 1000000;
+
+        int64_t now() const
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+        };
+
+        size_t levelOf(const T& item) const
+        {
+            size_t level = m_level(item);
+            return (level < Levels) ? level : (Levels - 1);
+        };
+
+        static int64_t keyOf(size_t level, int64_t pushed)
+        {
+            return (int64_t(level) * AgeNs) - pushed;
+        };
+
+        void record(const Entry& entry)
+        {
+            std::chrono::nanoseconds waited(now() - entry.pushed);
+            TSPriorityWaitStats &stats = m_stats[entry.level];
+            stats.count++;
+            stats.total += waited;
+            if (waited > stats.longest)
+            {
+                stats.longest = waited;
+            }
+        };
+
+        std::chrono::steady_clock::time_point m_start;
+        Heap m_heap;
+        TSPriorityWaitStats m_stats[Levels];
+        Level m_level;
+};
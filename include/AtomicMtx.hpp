@@ -42,20 +42,128 @@
 
 #include <atomic>
 using std::atomic_flag;
+#include <chrono>
 #include <mutex>            // Just for lock_guard...
 using std::lock_guard;
 #include <thread>
 using std::this_thread::yield;
+#include <type_traits>
+#include <LockProfile.hpp>
 #include <NONCOPY.hpp>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// How hard a contended lock spins before giving the CPU back.  Spinning goes
+// ATOMICMTX_SPIN_ROUNDS rounds, pausing twice as long each round up to
+// ATOMICMTX_MAX_PAUSES pause instructions; then ATOMICMTX_YIELD_ROUNDS
+// rounds of yield(); then it sleeps ATOMICMTX_SLEEP_US between looks.
+#if !defined(ATOMICMTX_SPIN_ROUNDS)
+#define ATOMICMTX_SPIN_ROUNDS       10
+#endif
+#if !defined(ATOMICMTX_MAX_PAUSES)
+#define ATOMICMTX_MAX_PAUSES        32
+#endif
+#if !defined(ATOMICMTX_YIELD_ROUNDS)
+#define ATOMICMTX_YIELD_ROUNDS      64
+#endif
+#if !defined(ATOMICMTX_SLEEP_US)
+#define ATOMICMTX_SLEEP_US          50
+#endif
+
+
+/// Tells the CPU we're in a spin-wait.  On x86 and ARM that's an instruction
+/// that lets the other hyperthread have the core and keeps us from flooding
+/// the memory system with speculative loads; elsewhere it's just a compiler
+/// barrier.
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__) || (defined(__arm__) && defined(__ARM_ARCH) && (__ARM_ARCH >= 7))
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+};
+
+
+/// Bounded exponential backoff for spin-waits: call pause() each time you
+/// look and come up empty.  Starts with a few pause instructions, doubles
+/// up to a cap, then falls back to yield(), then to short sleeps, so a
+/// waiter behind a preempted holder stops burning a core.
+class SpinBackoff
+{
+    public:
+        SpinBackoff() : m_pauses(1), m_rounds(0)
+#if defined(RPE_LOCK_PROFILE)
+            , m_spins(0)
+#endif
+        {};
+
+        void pause()
+        {
+#if defined(RPE_LOCK_PROFILE)
+            m_spins++;
+#endif
+            if (m_rounds < ATOMICMTX_SPIN_ROUNDS)
+            {
+                for (unsigned i = 0; i < m_pauses; i++)
+                {
+                    cpuRelax();
+                }
+                if (m_pauses < ATOMICMTX_MAX_PAUSES)
+                {
+                    m_pauses <<= 1;
+                }
+                m_rounds++;
+            }
+            else if (m_rounds < (ATOMICMTX_SPIN_ROUNDS + ATOMICMTX_YIELD_ROUNDS))
+            {
+                yield();
+                m_rounds++;
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(ATOMICMTX_SLEEP_US));
+            }
+        };
+
+        /// Number of times pause() has been called, up to where it starts
+        /// sleeping.
+        unsigned rounds() const { return m_rounds; };
+
+#if defined(RPE_LOCK_PROFILE)
+        /// Number of times pause() has been called, all told.
+        uint64_t spins() const { return m_spins; };
+#endif
+
+    private:
+        unsigned m_pauses;
+        unsigned m_rounds;
+#if defined(RPE_LOCK_PROFILE)
+        uint64_t m_spins;
+#endif
+};
+
 
 /*
 	Adding a notion of a bit of an Atomic operations mutex.  This, on modern
 	CPUs for systems (Embedded and otherwise...) is guaranteed with a properly
 	compliant C++ compiler to be lock-free and single cycle execution.  Coupled
-	with a good macro to quickly stage a grab for the lock that spins with a
-	yield() when called and when the variable defined by the macro leaves scope
-	it unlocks for you so you only need to worry about LOCKING.
+	with a good macro to quickly stage a grab for the lock that spins when
+	called and when the variable defined by the macro leaves scope it unlocks
+	for you so you only need to worry about LOCKING.
+
+	Waiting is test-and-test-and-set: a waiter watches the flag with plain
+	loads, which all the waiters can do from their own cached copy of it, and
+	only tries the atomic exchange (which has to take the cache line away from
+	everyone else) once it's seen the lock go free.  In between looks it backs
+	off with SpinBackoff.
+
+	With RPE_LOCK_PROFILE defined, it counts itself in the LockProfile under
+	the name it's given (AtomicMtx if it isn't).
 
 	It has some provisos.  The main one is that you can't re-grab a lock.  Not
 	that was a good idea or practice to begin with...  Just...don't.
@@ -64,16 +172,79 @@ class AtomicMtx : public NONCOPY
 {
     public:
         /// Default constructor.
-        AtomicMtx() : flag(ATOMIC_FLAG_INIT) {};
+        AtomicMtx() : AtomicMtx("AtomicMtx") {};
+
+        /// Constructor- name is what the lock profile calls it, if there is one.
+        explicit AtomicMtx(const char *name) : flag(false)
+#if defined(RPE_LOCK_PROFILE)
+            , m_probe(name)
+#endif
+        {
+            (void) name;
+        };
 
         /// Locks the mutex.
-        void lock() { while (flag.test_and_set(std::memory_order_acquire)) { yield(); }; };
+        void lock()
+        {
+            // Uncontended, this is the one exchange and we're done.
+            if (flag.exchange(true, std::memory_order_acquire))
+            {
+#if defined(RPE_LOCK_PROFILE)
+                uint64_t asked = LockProfile::now();
+#endif
+                SpinBackoff backoff;
+                do
+                {
+                    while (flag.load(std::memory_order_relaxed))
+                    {
+                        backoff.pause();
+                    }
+                } while (flag.exchange(true, std::memory_order_acquire));
+#if defined(RPE_LOCK_PROFILE)
+                m_probe.acquired(true, backoff.spins(), asked);
+                return;
+#endif
+            }
+#if defined(RPE_LOCK_PROFILE)
+            m_probe.acquired(false, 0, 0);
+#endif
+        };
+
+        /// Tries to lock the mutex without waiting.  Returns true if we got it.
+        bool try_lock()
+        {
+            bool retVal = !flag.load(std::memory_order_relaxed) && !flag.exchange(true, std::memory_order_acquire);
+#if defined(RPE_LOCK_PROFILE)
+            if (retVal)
+            {
+                m_probe.acquired(false, 0, 0);
+            }
+#endif
+            return retVal;
+        };
 
         /// Unlocks the mutex.
-        void unlock() { flag.clear(); };
+        void unlock()
+        {
+#if defined(RPE_LOCK_PROFILE)
+            m_probe.released();
+#endif
+            flag.store(false, std::memory_order_release);
+        };
+
+        /// Renames the lock in the lock profile.
+        void profile_as(const char *name)
+        {
+            LOCKPROFILE_NAME(m_probe, name);
+        };
 
     private:
-        atomic_flag flag;
+        std::atomic<bool> flag;
+#if defined(RPE_LOCK_PROFILE)
+        LockProbe m_probe;
+#endif
 };
 
-#define ATOMIC_LCK(X) lock_guard<AtomicMtx> X_lck(X)
\ No newline at end of file
+// Locks X until the end of the enclosing scope.  Works for any of the
+// Lockables (AtomicMtx, TicketMtx, MCSMtx, std::mutex...).
+#define ATOMIC_LCK(X) lock_guard<std::remove_reference_t<decltype(X)>> X_lck(X)
\ No newline at end of file
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <FixedStorage.hpp>
+
+// A bucketed priority queue for small, fixed ranges of priorities...
+//
+// When there are only a handful of priority levels (message classes and the
+// like), a comparison heap is wasted work.  This keeps one FIFO per level and
+// a bitmap of which levels have anything in them; the front is the highest
+// set bit, found with a count-leading-zeros per 64 levels.  push, pop, erase
+// and update are all O(1), and entries at the same level come out in the
+// order they went in, which a heap doesn't promise.
+//
+// You don't normally use this directly- give TSPriorityQueue a PriorityLevels
+// where the Compare would go and it picks this instead of a DaryHeap:
+//
+//     TSPriorityQueue<Message, 0, PriorityLevels<16, MessageClass>> queue;
+//
+// The Handle/update()/erase() interface matches DaryHeap's.  An update() that
+// changes an entry's level sends it to the back of its new level's FIFO.
+
+// Default level of an item- the item itself, for integers and enums.
+struct ItemLevel
+{
+    template <typename T> size_t operator()(const T& item) const { return static_cast<size_t>(item); };
+};
+
+// Selects a BucketQueue with Levels priority levels (0 lowest) for
+// TSPriorityQueue.  Level(item) gives an item's level; anything past the
+// top counts as the top level.
+template <size_t Levels, typename Level = ItemLevel> struct PriorityLevels
+{
+    static_assert(Levels > 0, "PriorityLevels needs at least one level");
+};
+
+template <typename T, size_t Levels, typename Level = ItemLevel, size_t Capacity = 0> class BucketQueue {
+    public:
+        /// Refers to one entry for update()/erase().  A default Handle never
+        /// refers to anything.
+        struct Handle
+        {
+            size_t slot = SIZE_MAX;
+            uint32_t generation = 0;
+
+            bool valid() const                      { return slot != SIZE_MAX; };
+        };
+
+        BucketQueue() : m_bitmap(), m_count(0) {};
+
+        BucketQueue(const BucketQueue&) = delete;
+        BucketQueue& operator=(const BucketQueue&) = delete;
+
+        Handle push(const T& item)                  { return emplace(item); };
+        Handle push(T&& item)                       { return emplace(std::move(item)); };
+        template <typename... Args> Handle emplace(Args&&... args)
+        {
+            uint32_t slot = allocSlot();
+            Node &node = m_nodes[slot];
+            node.value.emplace(std::forward<Args>(args)...);
+            link(slot, levelOf(*node.value));
+            return Handle{ slot, node.generation };
+        };
+
+        const T& top() const                        { return *m_nodes[m_buckets[highest()].head].value; };
+
+        /// Moves the top entry out and removes it.
+        T take()
+        {
+            uint32_t slot = m_buckets[highest()].head;
+            T retVal = std::move(*m_nodes[slot].value);
+            remove(slot);
+            return retVal;
+        };
+
+        void pop()                                  { remove(m_buckets[highest()].head); };
+
+        /// True if handle still refers to an entry in the queue.
+        bool contains(const Handle& handle) const
+        {
+            return handle.valid() && (handle.slot < m_nodes.size()) &&
+                   (m_nodes[handle.slot].generation == handle.generation) &&
+                   m_nodes[handle.slot].value.has_value();
+        };
+
+        /// Replaces the value of handle's entry, moving it to the back of its
+        /// new level if the level changed.  Returns false if the handle is stale.
+        bool update(const Handle& handle, const T& item)
+        {
+            if (!contains(handle))
+            {
+                return false;
+            }
+            Node &node = m_nodes[handle.slot];
+            size_t level = levelOf(item);
+            *node.value = item;
+            if (level != node.level)
+            {
+                unlink(handle.slot);
+                link(handle.slot, level);
+            }
+            return true;
+        };
+
+        /// Removes handle's entry.  Returns false if the handle is stale.
+        bool erase(const Handle& handle)
+        {
+            if (!contains(handle))
+            {
+                return false;
+            }
+            remove(handle.slot);
+            return true;
+        };
+
+        /// Swaps item in for the oldest entry at the lowest occupied level,
+        /// if item's level is higher, so a full queue can shed its least
+        /// important entry rather than the newest one.  Returns the new
+        /// entry's handle, which is not valid() if item was the one that lost.
+        Handle replace_lowest(const T& item)
+        {
+            if (empty())
+            {
+                return Handle();
+            }
+            size_t lowest = lowestLevel();
+            if (levelOf(item) <= lowest)
+            {
+                return Handle();
+            }
+            remove(m_buckets[lowest].head);
+            return push(item);
+        };
+
+        bool empty() const                          { return m_count == 0; };
+        size_t size() const                         { return m_count; };
+
+    private:
+        static const uint32_t NIL = UINT32_MAX;
+        static const size_t Words = (Levels + 63) / 64;
+
+        struct Node
+        {
+            std::optional<T> value;             // Empty while the slot's on the free list
+            size_t level = 0;
+            uint32_t prev = NIL;
+            uint32_t next = NIL;
+            uint32_t generation = 0;            // Bumped on every reuse, to spot stale handles
+        };
+
+        struct Bucket
+        {
+            uint32_t head = NIL;                // Oldest entry at this level
+            uint32_t tail = NIL;                // Newest
+        };
+
+        template <typename U> using Store = std::conditional_t<(Capacity > 0), FixedVector<U, Capacity>, std::vector<U>>;
+
+        size_t levelOf(const T& item) const
+        {
+            size_t level = m_level(item);
+            return (level < Levels) ? level : (Levels - 1);
+        };
+
+        size_t highest() const
+        {
+            for (size_t word = Words; word-- > 0; )
+            {
+                if (m_bitmap[word] != 0)
+                {
+                    return (word * 64) + 63 - __builtin_clzll(m_bitmap[word]);
+                }
+            }
+            return 0;
+        };
+
+        size_t lowestLevel() const
+        {
+            for (size_t word = 0; word < Words; word++)
+            {
+                if (m_bitmap[word] != 0)
+                {
+                    return (word * 64) + __builtin_ctzll(m_bitmap[word]);
+                }
+            }
+            return 0;
+        };
+
+        uint32_t allocSlot()
+        {
+            if (m_free.empty())
+            {
+                m_nodes.push_back(Node());
+                return (uint32_t) (m_nodes.size() - 1);
+            }
+            uint32_t slot = m_free.back();
+            m_free.pop_back();
+            m_nodes[slot].generation++;
+            return slot;
+        };
+
+        // Puts slot on the back of level's FIFO.
+        void link(uint32_t slot, size_t level)
+        {
+            Node &node = m_nodes[slot];
+            Bucket &bucket = m_buckets[level];
+            node.level = level;
+            node.prev = bucket.tail;
+            node.next = NIL;
+            if (bucket.tail == NIL)
+            {
+                bucket.head = slot;
+                m_bitmap[level / 64] |= (uint64_t(1) << (level % 64));
+            }
+            else
+            {
+                m_nodes[bucket.tail].next = slot;
+            }
+            bucket.tail = slot;
+            m_count++;
+        };
+
+        void unlink(uint32_t slot)
+        {
+            Node &node = m_nodes[slot];
+            Bucket &bucket = m_buckets[node.level];
+            if (node.prev == NIL)
+            {
+                bucket.head = node.next;
+            }
+            else
+            {
+                m_nodes[node.prev].next = node.next;
+            }
+            if (node.next == NIL)
+            {
+                bucket.tail = node.prev;
+            }
+            else
+            {
+                m_nodes[node.next].prev = node.prev;
+            }
+            if (bucket.head == NIL)
+            {
+                m_bitmap[node.level / 64] &= ~(uint64_t(1) << (node.level % 64));
+            }
+            m_count--;
+        };
+
+        void remove(uint32_t slot)
+        {
+            unlink(slot);
+            m_nodes[slot].value.reset();
+            m_free.push_back(slot);
+        };
+
+        Bucket m_buckets[Levels];
+        uint64_t m_bitmap[Words];               // Bit n set when level n has entries
+        Store<Node> m_nodes;
+        Store<uint32_t> m_free;                 // Slots ready for reuse
+        size_t m_count;
+        Level m_level;
+};
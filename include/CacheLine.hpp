@@ -0,0 +1,9 @@
+#pragma once
+
+// Size, in bytes, we pad hot shared indices/flags out to so that two
+// of them never land in the same cache line and ping-pong between
+// cores.  64 is right for every x86 and nearly every ARM part we ship
+// on- override it on the compile line if your target differs.
+#if !defined(CACHELINE_SIZE)
+#define CACHELINE_SIZE 64
+#endif
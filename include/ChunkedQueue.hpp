@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// A segmented-block stand-in for std::queue...
+//
+// Entries live in fixed-size segments chained head to tail, the same idea as
+// std::deque's blocks.  The difference is what happens to a segment once it's
+// been drained: std::deque hands it back to the allocator and asks for a new
+// one a moment later, where we park it on a per-queue free list and reuse it.
+// Under steady churn a queue settles on the handful of segments it needs and
+// push/pop never see the allocator again.  After a burst, trim() gives the
+// spares back.
+//
+// This is the storage behind an unbounded (Capacity 0) TSQueue.  Like the
+// FixedStorage containers, only the std::queue subset TSQueue uses is here,
+// and it doesn't check for underflow.
+
+// Default entries per segment- about a kilobyte's worth, but never fewer than 8.
+template <typename T> constexpr size_t ChunkedQueueSegmentSize = ((1024 / sizeof(T)) > 8) ? (1024 / sizeof(T)) : 8;
+
+template <typename T, size_t SegmentSize = ChunkedQueueSegmentSize<T>> class ChunkedQueue {
+    public:
+        ChunkedQueue() :
+            m_head(NULL), m_headIndex(0), m_tail(NULL), m_tailIndex(0),
+            m_free(NULL), m_freeCount(0), m_count(0) {};
+
+        ~ChunkedQueue()
+        {
+            while (!empty())
+            {
+                pop();
+            }
+            releaseSegment(m_head);
+            trim(0);
+        };
+
+        ChunkedQueue(const ChunkedQueue&) = delete;
+        ChunkedQueue& operator=(const ChunkedQueue&) = delete;
+
+        void push(const T& item)                    { emplace(item); };
+        void push(T&& item)                         { emplace(std::move(item)); };
+        template <typename... Args> void emplace(Args&&... args)
+        {
+            if ((m_tail == NULL) || (m_tailIndex == SegmentSize))
+            {
+                Segment *segment = acquireSegment();
+                if (m_tail == NULL)
+                {
+                    m_head = segment;
+                    m_headIndex = 0;
+                }
+                else
+                {
+                    m_tail->next = segment;
+                }
+                m_tail = segment;
+                m_tailIndex = 0;
+            }
+            new (m_tail->slot(m_tailIndex)) T(std::forward<Args>(args)...);
+            m_tailIndex++;
+            m_count++;
+        };
+
+        T& front()                                  { return *m_head->slot(m_headIndex); };
+        void pop()
+        {
+            m_head->slot(m_headIndex)->~T();
+            m_headIndex++;
+            m_count--;
+
+            if (m_count == 0)
+            {
+                // Empty- rewind onto the head segment rather than walking off of it,
+                // so a queue that bounces between 0 and a few entries never leaves it.
+                // (When we're empty, the head segment is the tail segment.)
+                m_headIndex = 0;
+                m_tailIndex = 0;
+            }
+            else if (m_headIndex == SegmentSize)
+            {
+                Segment *spent = m_head;
+                m_head = m_head->next;
+                m_headIndex = 0;
+                spent->next = NULL;
+                releaseSegment(spent);
+            }
+        };
+
+        bool empty() const                          { return m_count == 0; };
+        size_t size() const                         { return m_count; };
+
+        /// Hands spare segments back to the allocator, keeping at most keep
+        /// of them around for the next burst.
+        void trim(size_t keep = 0)
+        {
+            while ((m_freeCount > keep) && (m_free != NULL))
+            {
+                Segment *segment = m_free;
+                m_free = segment->next;
+                m_freeCount--;
+                delete segment;
+            }
+        };
+
+        /// Number of spare segments on the free list.
+        size_t spares() const                       { return m_freeCount; };
+
+    private:
+        struct Segment
+        {
+            Segment *next = NULL;
+            alignas(T) unsigned char storage[SegmentSize * sizeof(T)];
+
+            T* slot(size_t index) { return std::launder(reinterpret_cast<T*>(&storage[index * sizeof(T)])); };
+        };
+
+        Segment* acquireSegment()
+        {
+            Segment *segment = m_free;
+            if (segment != NULL)
+            {
+                m_free = segment->next;
+                m_freeCount--;
+                segment->next = NULL;
+            }
+            else
+            {
+                segment = new Segment;
+            }
+            return segment;
+        };
+
+        // Puts a (possibly NULL) chain of segments on the free list.
+        void releaseSegment(Segment *segment)
+        {
+            while (segment != NULL)
+            {
+                Segment *next = segment->next;
+                segment->next = m_free;
+                m_free = segment;
+                m_freeCount++;
+                segment = next;
+            }
+        };
+
+        Segment *m_head;                        // Oldest entry is m_head[m_headIndex]
+        size_t m_headIndex;
+        Segment *m_tail;                        // Next entry goes in m_tail[m_tailIndex]
+        size_t m_tailIndex;
+        Segment *m_free;                        // Drained segments waiting to be reused
+        size_t m_freeCount;
+        size_t m_count;
+};
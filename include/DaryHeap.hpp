@@ -0,0 +1,257 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <FixedStorage.hpp>
+
+// A 4-ary array heap with handles...
+//
+// This is the storage behind TSPriorityQueue.  Two things std::priority_queue
+// can't do:
+//
+// - Four children per node instead of two.  The tree is half as deep, and a
+//   node's children sit next to each other in the array, usually on the same
+//   cache line, so a sift down costs fewer misses even though it does a few
+//   more compares per level.
+// - push() hands back a Handle.  As long as that entry is still in the heap,
+//   update() can change its value (re-sifting it either way) and erase() can
+//   pull it out from the middle, both in O(log n).  Once the entry's popped
+//   or erased, the handle goes stale and both just return false- a recycled
+//   slot gets a new generation, so an old handle can't hit someone else's
+//   entry.
+//
+// Like std::priority_queue, Compare(a, b) being true means a comes out after
+// b.  With a Capacity, everything lives inline in FixedVectors and nothing
+// touches the allocator; without one, it's std::vectors that only grow.  As
+// with the other storage containers, there's no overflow/underflow checking.
+template <typename T, typename Compare = std::less<T>, size_t Capacity = 0> class DaryHeap {
+    public:
+        static const size_t Arity = 4;
+
+        /// Refers to one entry for update()/erase().  A default Handle never
+        /// refers to anything.
+        struct Handle
+        {
+            size_t slot = SIZE_MAX;
+            uint32_t generation = 0;
+
+            bool valid() const                      { return slot != SIZE_MAX; };
+        };
+
+        DaryHeap() {};
+
+        DaryHeap(const DaryHeap&) = delete;
+        DaryHeap& operator=(const DaryHeap&) = delete;
+
+        Handle push(const T& item)                  { return emplace(item); };
+        Handle push(T&& item)                       { return emplace(std::move(item)); };
+        template <typename... Args> Handle emplace(Args&&... args)
+        {
+            size_t slot = allocSlot();
+            m_nodes.emplace_back(slot, std::forward<Args>(args)...);
+            m_slots[slot].position = m_nodes.size() - 1;
+            siftUp(m_nodes.size() - 1);
+            return Handle{ slot, m_slots[slot].generation };
+        };
+
+        const T& top() const                        { return m_nodes[0].value; };
+
+        /// Moves the top entry out and removes it.
+        T take()
+        {
+            T retVal = std::move(m_nodes[0].value);
+            removeAt(0);
+            return retVal;
+        };
+
+        void pop()                                  { removeAt(0); };
+
+        /// True if handle still refers to an entry in the heap.
+        bool contains(const Handle& handle) const
+        {
+            return handle.valid() && (handle.slot < m_slots.size()) &&
+                   (m_slots[handle.slot].generation == handle.generation) &&
+                   (m_slots[handle.slot].position != SIZE_MAX);
+        };
+
+        /// The value of handle's entry, or NULL if the handle is stale.
+        const T* find(const Handle& handle) const
+        {
+            return contains(handle) ? &m_nodes[m_slots[handle.slot].position].value : NULL;
+        };
+
+        /// Replaces the value of handle's entry and moves it to where it now
+        /// belongs.  Returns false if the handle is stale.
+        bool update(const Handle& handle, const T& item)
+        {
+            if (!contains(handle))
+            {
+                return false;
+            }
+            size_t position = m_slots[handle.slot].position;
+            m_nodes[position].value = item;
+            siftUp(position);
+            siftDown(m_slots[handle.slot].position);
+            return true;
+        };
+
+        /// Removes handle's entry.  Returns false if the handle is stale.
+        bool erase(const Handle& handle)
+        {
+            if (!contains(handle))
+            {
+                return false;
+            }
+            removeAt(m_slots[handle.slot].position);
+            return true;
+        };
+
+        /// Swaps item in for the lowest priority entry, if item outranks it,
+        /// so a full heap can shed its least important entry rather than
+        /// the newest one.  The lowest entry is always a leaf, so this is a
+        /// scan of the last level.  Returns the new entry's handle, which is
+        /// not valid() if item was the one that lost.
+        Handle replace_lowest(const T& item)
+        {
+            if (m_nodes.empty())
+            {
+                return Handle();
+            }
+            size_t lowest = (m_nodes.size() > 1) ? (parent(m_nodes.size() - 1) + 1) : 0;
+            for (size_t i = lowest + 1; i < m_nodes.size(); i++)
+            {
+                if (m_compare(m_nodes[i].value, m_nodes[lowest].value))
+                {
+                    lowest = i;
+                }
+            }
+            if (!m_compare(m_nodes[lowest].value, item))
+            {
+                return Handle();
+            }
+            removeAt(lowest);
+            return push(item);
+        };
+
+        bool empty() const                          { return m_nodes.empty(); };
+        size_t size() const                         { return m_nodes.size(); };
+
+    private:
+        struct Node
+        {
+            template <typename... Args> Node(size_t slotIndex, Args&&... args) :
+                slot(slotIndex), value(std::forward<Args>(args)...) {};
+
+            size_t slot;                        // Back into m_slots, so a move can fix up the handle
+            T value;
+        };
+
+        struct Slot
+        {
+            size_t position;                    // Where the entry is in m_nodes, SIZE_MAX if free
+            uint32_t generation;                // Bumped on every reuse, to spot stale handles
+        };
+
+        template <typename U> using Store = std::conditional_t<(Capacity > 0), FixedVector<U, Capacity>, std::vector<U>>;
+
+        static size_t parent(size_t index)          { return (index - 1) / Arity; };
+
+        size_t allocSlot()
+        {
+            if (m_free.empty())
+            {
+                m_slots.push_back(Slot{ SIZE_MAX, 0 });
+                return m_slots.size() - 1;
+            }
+            size_t slot = m_free.back();
+            m_free.pop_back();
+            m_slots[slot].generation++;
+            return slot;
+        };
+
+        void removeAt(size_t position)
+        {
+            size_t slot = m_nodes[position].slot;
+            m_slots[slot].position = SIZE_MAX;
+            m_free.push_back(slot);
+
+            size_t last = m_nodes.size() - 1;
+            if (position != last)
+            {
+                m_nodes[position] = std::move(m_nodes[last]);
+                m_slots[m_nodes[position].slot].position = position;
+            }
+            m_nodes.pop_back();
+
+            // Whatever came off the end could belong above or below the hole.
+            if (position < m_nodes.size())
+            {
+                siftUp(position);
+                siftDown(m_slots[m_nodes[position].slot].position);
+            }
+        };
+
+        // Both sifts carry the moving entry in hand and shift the others
+        // over the hole, rather than swapping at every level.
+        void siftUp(size_t position)
+        {
+            Node moving = std::move(m_nodes[position]);
+            while (position > 0)
+            {
+                size_t up = parent(position);
+                if (!m_compare(m_nodes[up].value, moving.value))
+                {
+                    break;
+                }
+                place(position, std::move(m_nodes[up]));
+                position = up;
+            }
+            place(position, std::move(moving));
+        };
+
+        void siftDown(size_t position)
+        {
+            size_t count = m_nodes.size();
+            Node moving = std::move(m_nodes[position]);
+            for (;;)
+            {
+                size_t first = (Arity * position) + 1;
+                if (first >= count)
+                {
+                    break;
+                }
+                size_t best = first;
+                size_t end = ((first + Arity) < count) ? (first + Arity) : count;
+                for (size_t child = first + 1; child < end; child++)
+                {
+                    if (m_compare(m_nodes[best].value, m_nodes[child].value))
+                    {
+                        best = child;
+                    }
+                }
+                if (!m_compare(moving.value, m_nodes[best].value))
+                {
+                    break;
+                }
+                place(position, std::move(m_nodes[best]));
+                position = best;
+            }
+            place(position, std::move(moving));
+        };
+
+        void place(size_t position, Node&& node)
+        {
+            m_nodes[position] = std::move(node);
+            m_slots[m_nodes[position].slot].position = position;
+        };
+
+        Store<Node> m_nodes;
+        Store<Slot> m_slots;
+        Store<size_t> m_free;                   // Slots ready for reuse
+        Compare m_compare;
+};
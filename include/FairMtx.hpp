@@ -0,0 +1,245 @@
+/*
+ * FairMtx.hpp
+ *
+ * First-come, first-served spinlocks to go alongside AtomicMtx for when
+ * a waiter can't afford to lose the race over and over.
+ *
+ * Copyright (c) 2013-2024 Frank C. Earl, All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.  You may add your
+ *    own copyright notice relative to your modifications, but you cannot claim
+ *    the code herein as solely your own.
+ *
+ * 2. Binary redistributions must reproduce the above copyright notice, either
+ *    in the initial output of the derived application, a "help" screen, or in
+ *    the documentation that accompanies the same.
+ *
+ * 3. Neither the name of the copyright holder nor the names of this software's
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.  Compliance with
+ *    condition 2 does not constitute a violation of this condition.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * SPECIFICALLY DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+#include <AtomicMtx.hpp>
+#include <CacheLine.hpp>
+#include <NONCOPY.hpp>
+
+
+/*
+	AtomicMtx is a free-for-all: whoever's exchange lands first after an
+	unlock gets the lock, and that's usually the thread that just let go of
+	it since it's still got the cache line.  Under contention one thread can
+	win over and over while the others wait milliseconds.
+
+	These two hand the lock over in the order it was asked for.  Both are
+	drop-in Lockables- lock_guard, unique_lock and ATOMIC_LCK all work- and
+	both back off with SpinBackoff like AtomicMtx, so a waiter behind a
+	preempted holder eventually gives its core back.  Same proviso: no
+	re-grabbing a lock you already hold.
+
+	TicketMtx is the cheap one: take a number, wait for it to be called.
+	Every waiter watches the same "now serving" counter, so each handoff
+	still touches every waiter's cache.
+
+	MCSMtx queues the waiters up in a linked list and each one watches a
+	flag in its own node, which its predecessor sets on the way out.  A
+	handoff touches exactly one other cache line no matter how many are
+	waiting.  The nodes come from a small per-thread pool, so lock() and
+	unlock() look like anybody else's.
+
+	The price of fairness: the lock can only go to the next in line, so if
+	that thread isn't on a CPU right now, nobody gets it until it is.  With
+	more contending threads than cores that convoy costs a lot of throughput-
+	these are for a few threads on their own cores, not a crowd.
+*/
+class TicketMtx : public NONCOPY
+{
+    public:
+        /// Default constructor.
+        TicketMtx() : m_next(0), m_serving(0) {};
+
+        /// Locks the mutex, after everyone who asked before us.
+        void lock()
+        {
+            unsigned ticket = m_next.fetch_add(1, std::memory_order_relaxed);
+            if (m_serving.load(std::memory_order_acquire) != ticket)
+            {
+                SpinBackoff backoff;
+                while (m_serving.load(std::memory_order_acquire) != ticket)
+                {
+                    backoff.pause();
+                }
+            }
+        };
+
+        /// Tries to lock the mutex without waiting.  Only succeeds if
+        /// nobody holds it or is queued for it.
+        bool try_lock()
+        {
+            unsigned serving = m_serving.load(std::memory_order_acquire);
+            return m_next.compare_exchange_strong(serving, serving + 1, std::memory_order_acquire, std::memory_order_relaxed);
+        };
+
+        /// Unlocks the mutex, handing it to the next ticket.
+        void unlock()
+        {
+            // Only the holder ever writes this, so no RMW needed.
+            m_serving.store(m_serving.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        };
+
+    private:
+        alignas(CACHELINE_SIZE) std::atomic<unsigned> m_next;      // Next ticket to hand out
+        alignas(CACHELINE_SIZE) std::atomic<unsigned> m_serving;   // Ticket that holds the lock
+};
+
+
+// How many MCSMtx a thread can hold at once before lock() starts allocating
+// nodes instead of using its pool.
+#if !defined(MCSMTX_POOL_SIZE)
+#define MCSMTX_POOL_SIZE    8
+#endif
+
+class MCSMtx : public NONCOPY
+{
+    public:
+        /// Default constructor.
+        MCSMtx() : m_tail(NULL), m_owner(NULL) {};
+
+        /// Locks the mutex, after everyone who asked before us.
+        void lock()
+        {
+            Node *node = acquireNode();
+            Node *prev = m_tail.exchange(node, std::memory_order_acq_rel);
+            if (prev != NULL)
+            {
+                // Get in line behind prev and wait for it to tell us we're up.
+                node->locked.store(true, std::memory_order_relaxed);
+                prev->next.store(node, std::memory_order_release);
+                SpinBackoff backoff;
+                while (node->locked.load(std::memory_order_acquire))
+                {
+                    backoff.pause();
+                }
+            }
+            m_owner = node;
+        };
+
+        /// Tries to lock the mutex without waiting.  Only succeeds if
+        /// nobody holds it or is queued for it.
+        bool try_lock()
+        {
+            Node *node = acquireNode();
+            Node *expected = NULL;
+            if (!m_tail.compare_exchange_strong(expected, node, std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+                releaseNode(node);
+                return false;
+            }
+            m_owner = node;
+            return true;
+        };
+
+        /// Unlocks the mutex, handing it to the next in line.
+        void unlock()
+        {
+            Node *node = m_owner;
+            Node *next = node->next.load(std::memory_order_acquire);
+            if (next == NULL)
+            {
+                // Nobody in line that we know of.  If we're still the tail,
+                // there really is nobody and we're done...
+                Node *expected = node;
+                if (m_tail.compare_exchange_strong(expected, NULL, std::memory_order_acq_rel, std::memory_order_relaxed))
+                {
+                    releaseNode(node);
+                    return;
+                }
+
+                // ...otherwise someone's swapped themselves in as the tail but
+                // hasn't linked up to us yet.  It's only a few instructions away,
+                // unless it got preempted in between.
+                SpinBackoff backoff;
+                while ((next = node->next.load(std::memory_order_acquire)) == NULL)
+                {
+                    backoff.pause();
+                }
+            }
+            next->locked.store(false, std::memory_order_release);
+            releaseNode(node);
+        };
+
+    private:
+        struct alignas(CACHELINE_SIZE) Node
+        {
+            std::atomic<Node *> next;
+            std::atomic<bool> locked;
+        };
+
+        // Each thread's spare nodes.  Only its own thread ever touches it.
+        struct NodePool
+        {
+            Node nodes[MCSMTX_POOL_SIZE];
+            Node *free[MCSMTX_POOL_SIZE];
+            size_t count;
+
+            NodePool() : count(MCSMTX_POOL_SIZE)
+            {
+                for (size_t i = 0; i < MCSMTX_POOL_SIZE; i++)
+                {
+                    free[i] = &nodes[MCSMTX_POOL_SIZE - 1 - i];
+                }
+            };
+        };
+
+        static NodePool& pool()
+        {
+            static thread_local NodePool threadPool;
+            return threadPool;
+        };
+
+        static Node* acquireNode()
+        {
+            NodePool &threadPool = pool();
+            Node *node = (threadPool.count > 0) ? threadPool.free[--threadPool.count] : new Node;
+            node->next.store(NULL, std::memory_order_relaxed);
+            return node;
+        };
+
+        static void releaseNode(Node *node)
+        {
+            NodePool &threadPool = pool();
+            if ((node >= &threadPool.nodes[0]) && (node < &threadPool.nodes[MCSMTX_POOL_SIZE]))
+            {
+                threadPool.free[threadPool.count++] = node;
+            }
+            else
+            {
+                delete node;
+            }
+        };
+
+        std::atomic<Node *> m_tail;                 // Last in line, NULL if the lock's free
+        Node *m_owner;                              // Holder's node, for unlock()
+};
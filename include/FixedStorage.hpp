@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// Inline, fixed-capacity stand-ins for std::queue and std::vector.
+//
+// These are the storage behind TSQueue<T, N> and TSPriorityQueue<T, N> when
+// you give them a compile-time capacity.  The elements live in the object
+// itself- nothing touches the heap after construction, so real-time threads
+// pushing and popping never end up in the allocator.  Only the subset of the
+// std:: container interfaces the thread-safe wrappers use is provided, and
+// none of it checks for overflow or underflow; that's the wrapper's job.
+
+
+// A ring of up to N elements with std::queue's push/emplace/front/pop.
+template <typename T, size_t N> class FixedRing {
+    public:
+        FixedRing() : m_head(0), m_count(0) {};
+        ~FixedRing() { while (!empty()) { pop(); } };
+
+        FixedRing(const FixedRing&) = delete;
+        FixedRing& operator=(const FixedRing&) = delete;
+
+        void push(const T& item)                    { emplace(item); };
+        void push(T&& item)                         { emplace(std::move(item)); };
+        template <typename... Args> void emplace(Args&&... args)
+        {
+            new (slot((m_head + m_count) % N)) T(std::forward<Args>(args)...);
+            m_count++;
+        };
+
+        T& front()                                  { return *slot(m_head); };
+        void pop()
+        {
+            slot(m_head)->~T();
+            m_head = (m_head + 1) % N;
+            m_count--;
+        };
+
+        bool empty() const                          { return m_count == 0; };
+        size_t size() const                         { return m_count; };
+
+    private:
+        T* slot(size_t index)                       { return std::launder(reinterpret_cast<T*>(&m_storage[index * sizeof(T)])); };
+
+        alignas(T) unsigned char m_storage[N * sizeof(T)];
+        size_t m_head;
+        size_t m_count;
+};
+
+
+// An array of up to N elements with std::vector's push_back/pop_back/back and
+// indexing.  This is what a fixed-capacity DaryHeap keeps its entries in.
+template <typename T, size_t N> class FixedVector {
+    public:
+        FixedVector() : m_count(0) {};
+        ~FixedVector() { while (m_count > 0) { pop_back(); } };
+
+        FixedVector(const FixedVector&) = delete;
+        FixedVector& operator=(const FixedVector&) = delete;
+
+        void push_back(const T& item)               { emplace_back(item); };
+        void push_back(T&& item)                    { emplace_back(std::move(item)); };
+        template <typename... Args> void emplace_back(Args&&... args)
+        {
+            new (slot(m_count)) T(std::forward<Args>(args)...);
+            m_count++;
+        };
+
+        void pop_back()                             { slot(--m_count)->~T(); };
+        T& back()                                   { return *slot(m_count - 1); };
+
+        T& operator[](size_t index)                 { return *slot(index); };
+        const T& operator[](size_t index) const     { return *slot(index); };
+
+        bool empty() const                          { return m_count == 0; };
+        size_t size() const                         { return m_count; };
+
+    private:
+        T* slot(size_t index)                       { return std::launder(reinterpret_cast<T*>(&m_storage[index * sizeof(T)])); };
+        const T* slot(size_t index) const           { return std::launder(reinterpret_cast<const T*>(&m_storage[index * sizeof(T)])); };
+
+        alignas(T) unsigned char m_storage[N * sizeof(T)];
+        size_t m_count;
+};
@@ -0,0 +1,197 @@
+/*
+ * FutexMtx.hpp
+ *
+ * A spin-then-sleep mutex: spins briefly like AtomicMtx, then parks in the
+ * kernel on a Linux futex instead of burning the CPU.
+ *
+ * Copyright (c) 2013-2024 Frank C. Earl, All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.  You may add your
+ *    own copyright notice relative to your modifications, but you cannot claim
+ *    the code herein as solely your own.
+ *
+ * 2. Binary redistributions must reproduce the above copyright notice, either
+ *    in the initial output of the derived application, a "help" screen, or in
+ *    the documentation that accompanies the same.
+ *
+ * 3. Neither the name of the copyright holder nor the names of this software's
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.  Compliance with
+ *    condition 2 does not constitute a violation of this condition.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * SPECIFICALLY DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <AtomicMtx.hpp>
+#include <NONCOPY.hpp>
+
+// Upper bound on how many times lock() looks at a held lock before it
+// parks.  Per-lock, it can be set at construction.
+#if !defined(FUTEXMTX_SPIN_LIMIT)
+#define FUTEXMTX_SPIN_LIMIT     100
+#endif
+
+
+/*
+	AtomicMtx is hard to beat while the holder is running- but if the holder
+	gets preempted, everyone waiting spins (and eventually yield()s) until
+	it's scheduled again, which on a 2-core board is everyone else's CPU.
+
+	FutexMtx is the classic three-state futex mutex (unlocked, locked, locked
+	with sleepers) with a spin phase in front:
+
+		- Uncontended, lock() and unlock() are one atomic op each, the same
+		  as AtomicMtx, and never go near the kernel.
+		- Contended, lock() watches the lock (reading, not writing, with a
+		  cpuRelax() between looks) for a while in case the holder's about to
+		  let go.  How long adapts, per lock, to how long it's taken lately,
+		  capped at the spin limit.  Then it parks in the kernel on a futex
+		  and costs nothing until it's woken.
+		- unlock() only makes a syscall if somebody's actually parked.
+
+	It's a drop-in Lockable (lock_guard, unique_lock, ATOMIC_LCK), and
+	TSQueue/MessageManager take it as their Lock parameter.  Off Linux,
+	there's no futex to park on, so it parks the way AtomicMtx does- with
+	yield() and short sleeps.
+*/
+class FutexMtx : public NONCOPY
+{
+    public:
+        /**
+         * Constructor
+         *
+         * @param spinLimit The most times lock() looks at a held lock before
+         *                  parking.  Zero parks straight away.
+         */
+        FutexMtx(unsigned spinLimit = FUTEXMTX_SPIN_LIMIT) :
+            m_state(UNLOCKED), m_spinLimit(spinLimit), m_spinEstimate(spinLimit / 2) {};
+
+        /// Locks the mutex.
+        void lock()
+        {
+            int expected = UNLOCKED;
+            if (!m_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                lockSlow();
+            }
+        };
+
+        /// Tries to lock the mutex without waiting.  Returns true if we got it.
+        bool try_lock()
+        {
+            int expected = UNLOCKED;
+            return m_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed);
+        };
+
+        /// Unlocks the mutex, waking one sleeper if there are any.
+        void unlock()
+        {
+            if (m_state.exchange(UNLOCKED, std::memory_order_release) == SLEEPERS)
+            {
+                wake();
+            }
+        };
+
+    private:
+        enum { UNLOCKED = 0, LOCKED = 1, SLEEPERS = 2 };
+
+        void lockSlow()
+        {
+            // Spin phase.  Aim for a bit past what it's taken lately, so a lock
+            // that's usually handed over quickly gets spun on, and one that
+            // isn't stops wasting the time.
+            unsigned limit = (2 * m_spinEstimate.load(std::memory_order_relaxed)) + 10;
+            if (limit > m_spinLimit)
+            {
+                limit = m_spinLimit;
+            }
+            for (unsigned spins = 0; spins < limit; spins++)
+            {
+                int state = m_state.load(std::memory_order_relaxed);
+                if (state == UNLOCKED)
+                {
+                    int expected = UNLOCKED;
+                    if (m_state.compare_exchange_weak(expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed))
+                    {
+                        adapt(spins);
+                        return;
+                    }
+                }
+                else if (state == SLEEPERS)
+                {
+                    // Somebody's already given up and parked.  No point in us
+                    // out-waiting them.
+                    break;
+                }
+                cpuRelax();
+            }
+            adapt(limit);
+
+            // Park phase.  Mark the lock as having sleepers (so the holder
+            // knows to wake us) and sleep until it's free- if we're the one who
+            // takes it from UNLOCKED, we've got it, still marked, since there
+            // may be more of us.
+            SpinBackoff backoff;
+            while (m_state.exchange(SLEEPERS, std::memory_order_acquire) != UNLOCKED)
+            {
+                park(backoff);
+            }
+        };
+
+        // Nudges the spin estimate an eighth of the way toward what it took.
+        void adapt(unsigned spins)
+        {
+            int estimate = (int) m_spinEstimate.load(std::memory_order_relaxed);
+            m_spinEstimate.store((unsigned) (estimate + (((int) spins - estimate) / 8)), std::memory_order_relaxed);
+        };
+
+        void park(SpinBackoff& backoff)
+        {
+#if defined(__linux__)
+            (void) backoff;
+            // Returns straight away if the lock's changed since we marked it.
+            syscall(SYS_futex, reinterpret_cast<int *>(&m_state), FUTEX_WAIT_PRIVATE, SLEEPERS, NULL, NULL, 0);
+#else
+            backoff.pause();
+#endif
+        };
+
+        void wake()
+        {
+#if defined(__linux__)
+            syscall(SYS_futex, reinterpret_cast<int *>(&m_state), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+        };
+
+        // The kernel's going to treat m_state as a plain int.
+        static_assert(sizeof(std::atomic<int>) == sizeof(int), "FutexMtx needs a lock-free atomic<int>");
+
+        std::atomic<int> m_state;
+        const unsigned m_spinLimit;
+        std::atomic<unsigned> m_spinEstimate;   // Recent spins to get the lock; a hint, so races don't matter
+};
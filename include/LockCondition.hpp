@@ -0,0 +1,17 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <type_traits>
+
+// Which condition variable a container waits on with a given Lock...
+//
+// std::condition_variable only works with std::mutex; for any other Lockable
+// the default is std::condition_variable_any.  A lock that has a better
+// partner (PI_MUTEX has PI_CONDITION) specializes this next to its own
+// definition.  Under RPE_LOCK_PROFILE, LockProfile.hpp forwards a wrapped
+// lock to its inner lock's partner.
+template <typename Lock> struct LockCondition
+{
+    using type = std::conditional_t<std::is_same_v<Lock, std::mutex>, std::condition_variable, std::condition_variable_any>;
+};
@@ -0,0 +1,159 @@
+/*
+ * LockPolicy.hpp
+ *
+ * The locks the library's containers can be built with, in one place, and
+ * the do-nothing one for single-threaded builds.
+ *
+ * Copyright (c) 2013-2024 Frank C. Earl, All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.  You may add your
+ *    own copyright notice relative to your modifications, but you cannot claim
+ *    the code herein as solely your own.
+ *
+ * 2. Binary redistributions must reproduce the above copyright notice, either
+ *    in the initial output of the derived application, a "help" screen, or in
+ *    the documentation that accompanies the same.
+ *
+ * 3. Neither the name of the copyright holder nor the names of this software's
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.  Compliance with
+ *    condition 2 does not constitute a violation of this condition.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * SPECIFICALLY DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>       // cv_status
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+
+#include <AtomicMtx.hpp>
+#include <FutexMtx.hpp>
+#include <LockCondition.hpp>
+#include <LockProfile.hpp>
+#include <NONCOPY.hpp>
+#include <PI_MUTEX.hpp>
+
+
+/*
+	TSQueue, TSPriorityQueue, TSShardedQueue, TSMultiQueue and MessageManager
+	all take a LockPolicy template parameter, which is simply the Lockable
+	they guard themselves with.  Pick the cheapest one that's still correct
+	for how the container's used:
+
+		NullMtx		No locking at all.  For single-threaded builds (a game
+					loop that never starts a second thread), where every
+					lock is pure overhead.  A wait that could never end-
+					pop_wait() on an empty queue, say- throws instead.
+		AtomicMtx	Spinlock.  For very short critical sections between
+					threads that are each on their own core.
+		std::mutex	The default.  Safe anywhere.
+		FutexMtx	Spins briefly, then sleeps in the kernel; on Linux
+					it's std::mutex with a cheaper contended handoff.
+		PI_MUTEX	Priority inheritance, for locks real-time threads
+					share with ordinary ones.
+
+	So, for instance:
+
+		TSQueue<Frame, 64, NullMtx> frames;				// Single-threaded
+		TSPriorityQueue<Job, 0, std::less<Job>, PI_MUTEX> jobs;	// RT consumer
+
+	Any other Lockable will do too.  The container waits on whatever
+	LockCondition pairs with its lock.
+*/
+
+/// A lock that doesn't.  Only for containers that are never touched by
+/// more than one thread.
+class NullMtx : public NONCOPY
+{
+    public:
+        void lock()                                 {};
+        bool try_lock()                             { return true; };
+        void unlock()                               {};
+
+        void profile_as(const char *name)           { (void) name; };
+};
+
+/// What a container waits on with a NullMtx.  With only one thread about,
+/// nothing can change while we wait: an untimed wait for something that
+/// isn't already so would be forever, so it throws instead, and a timed
+/// one just sleeps out its time.
+class NullCondition : public NONCOPY
+{
+    public:
+        void notify_one()                           {};
+        void notify_all()                           {};
+
+        template <typename Lock> void wait(Lock& lock)
+        {
+            (void) lock;
+            throw std::logic_error("NullCondition: waiting would block forever with a NullMtx");
+        };
+
+        template <typename Lock, typename Predicate> void wait(Lock& lock, Predicate pred)
+        {
+            if (!pred())
+            {
+                wait(lock);
+            }
+        };
+
+        template <typename Lock, typename Clock, typename Duration>
+            std::cv_status wait_until(Lock& lock, const std::chrono::time_point<Clock, Duration>& deadline)
+        {
+            (void) lock;
+            std::this_thread::sleep_until(deadline);
+            return std::cv_status::timeout;
+        };
+
+        template <typename Lock, typename Clock, typename Duration, typename Predicate>
+            bool wait_until(Lock& lock, const std::chrono::time_point<Clock, Duration>& deadline, Predicate pred)
+        {
+            if (!pred())
+            {
+                wait_until(lock, deadline);
+            }
+            return pred();
+        };
+
+        template <typename Lock, typename Rep, typename Period>
+            std::cv_status wait_for(Lock& lock, const std::chrono::duration<Rep, Period>& timeout)
+        {
+            return wait_until(lock, std::chrono::steady_clock::now() + timeout);
+        };
+
+        template <typename Lock, typename Rep, typename Period, typename Predicate>
+            bool wait_for(Lock& lock, const std::chrono::duration<Rep, Period>& timeout, Predicate pred)
+        {
+            return wait_until(lock, std::chrono::steady_clock::now() + timeout, std::move(pred));
+        };
+};
+
+template <> struct LockCondition<NullMtx>
+{
+    using type = NullCondition;
+};
+
+#if defined(RPE_LOCK_PROFILE)
+// Nothing to profile in a lock that never waits or holds anything.
+template <> struct LockProfilesItself<NullMtx> : std::true_type {};
+#endif
@@ -0,0 +1,538 @@
+/*
+ * LockProfile.hpp
+ *
+ * Opt-in lock contention profiling for AtomicMtx and the locks inside the
+ * library's containers.
+ *
+ * Copyright (c) 2013-2024 Frank C. Earl, All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.  You may add your
+ *    own copyright notice relative to your modifications, but you cannot claim
+ *    the code herein as solely your own.
+ *
+ * 2. Binary redistributions must reproduce the above copyright notice, either
+ *    in the initial output of the derived application, a "help" screen, or in
+ *    the documentation that accompanies the same.
+ *
+ * 3. Neither the name of the copyright holder nor the names of this software's
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.  Compliance with
+ *    condition 2 does not constitute a violation of this condition.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * SPECIFICALLY DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#if defined(RPE_LOCK_PROFILE)
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <LockCondition.hpp>
+#include <NONCOPY.hpp>
+#endif
+
+
+/*
+	Which lock is it that's hurting?  Build with RPE_LOCK_PROFILE defined
+	and every AtomicMtx, and the lock inside every TSQueue, TSPriorityQueue
+	and MessageManager, keeps track of, per name:
+
+		- acquisitions, and how many of those had to wait
+		- how many times the waiters spun (AtomicMtx only- a wrapped
+		  std::mutex doesn't tell us)
+		- total time spent waiting for it, and total time it was held
+
+	Locks are named AtomicMtx, TSQueue and so on by default, and all the
+	locks with the same name are counted together.  Name the ones you care
+	about- AtomicMtx gpioLock("gpio"), or queue.profile_as("rx frames")- and
+	call LockProfile::report() to dump the worst of them.
+
+	The counters are kept per thread and only ever written by their own
+	thread, so the bookkeeping doesn't turn into a contended lock of its own;
+	the report adds them up.  It's still two clock reads per acquisition,
+	so it does cost something- which is why it's opt-in.
+
+	Without RPE_LOCK_PROFILE there's nothing: the locks are the plain types,
+	LOCKPROFILE_NAME() expands to nothing, and report() just says profiling
+	wasn't built in.
+*/
+
+#if defined(RPE_LOCK_PROFILE)
+
+// Most distinct lock names we'll track.  Any past that are counted together
+// as "(other)".
+#if !defined(LOCKPROFILE_MAX_SITES)
+#define LOCKPROFILE_MAX_SITES   128
+#endif
+
+/// Everything counted against one lock name.
+struct LockProfileEntry
+{
+    std::string name;
+    uint64_t acquisitions = 0;
+    uint64_t contended = 0;                     // Acquisitions that had to wait
+    uint64_t spins = 0;                         // Times the waiters looked and found it held
+    std::chrono::nanoseconds wait{0};           // Time spent waiting for it
+    std::chrono::nanoseconds hold{0};           // Time it was held
+};
+
+class LockProfile
+{
+    public:
+        /// What top() and report() rank the locks by.
+        enum SortBy { WAIT, HOLD, CONTENDED, ACQUISITIONS };
+
+        /// Every lock name seen so far, with its counts since the last reset().
+        static std::vector<LockProfileEntry> snapshot()
+        {
+            Registry &reg = registry();
+            std::lock_guard guard(reg.lock);
+            std::vector<LockProfileEntry> retVal(reg.names.size());
+            for (size_t site = 0; site < retVal.size(); site++)
+            {
+                Totals totals = reg.retired[site];
+                for (ThreadCounters *thread : reg.threads)
+                {
+                    thread->sites[site].addTo(totals);
+                }
+                LockProfileEntry &entry = retVal[site];
+                entry.name = reg.names[site];
+                entry.acquisitions = totals.acquisitions - reg.baseline[site].acquisitions;
+                entry.contended = totals.contended - reg.baseline[site].contended;
+                entry.spins = totals.spins - reg.baseline[site].spins;
+                entry.wait = std::chrono::nanoseconds(totals.waitNs - reg.baseline[site].waitNs);
+                entry.hold = std::chrono::nanoseconds(totals.holdNs - reg.baseline[site].holdNs);
+            }
+            return retVal;
+        };
+
+        /// The count worst locks by the given measure, worst first.  Locks
+        /// that haven't been taken since the last reset() are left out.
+        static std::vector<LockProfileEntry> top(size_t count, SortBy by = WAIT)
+        {
+            std::vector<LockProfileEntry> retVal = snapshot();
+            retVal.erase(std::remove_if(retVal.begin(), retVal.end(),
+                [](const LockProfileEntry& entry) { return entry.acquisitions == 0; }), retVal.end());
+            std::sort(retVal.begin(), retVal.end(), [by](const LockProfileEntry& a, const LockProfileEntry& b)
+            {
+                switch (by)
+                {
+                    case HOLD:          return a.hold > b.hold;
+                    case CONTENDED:     return a.contended > b.contended;
+                    case ACQUISITIONS:  return a.acquisitions > b.acquisitions;
+                    default:            return a.wait > b.wait;
+                }
+            });
+            if (retVal.size() > count)
+            {
+                retVal.resize(count);
+            }
+            return retVal;
+        };
+
+        /// Prints the count worst locks as a table.
+        static void report(FILE *out = stderr, size_t count = 10, SortBy by = WAIT)
+        {
+            std::vector<LockProfileEntry> entries = top(count, by);
+            fprintf(out, "Lock profile, top %zu:\n", count);
+            fprintf(out, "  %-24s %12s %12s %7s %12s %12s %12s %12s\n", "lock", "acquired", "contended", "%",
+                    "spins", "wait ms", "hold ms", "mean wait us");
+            for (const LockProfileEntry &entry : entries)
+            {
+                double waitMs = entry.wait.count() / 1e6;
+                double holdMs = entry.hold.count() / 1e6;
+                double meanWait = (entry.contended > 0) ? ((entry.wait.count() / 1e3) / entry.contended) : 0;
+                fprintf(out, "  %-24s %12llu %12llu %6.2f%% %12llu %12.3f %12.3f %12.3f\n", entry.name.c_str(),
+                        (unsigned long long) entry.acquisitions, (unsigned long long) entry.contended,
+                        (100.0 * entry.contended) / entry.acquisitions, (unsigned long long) entry.spins,
+                        waitMs, holdMs, meanWait);
+            }
+        };
+
+        /// Starts all the counts over from zero.
+        static void reset()
+        {
+            // The counters belong to their threads, so rather than zeroing
+            // them out from under them, remember where they are now and
+            // count from there.
+            std::vector<LockProfileEntry> current = snapshot();
+            Registry &reg = registry();
+            std::lock_guard guard(reg.lock);
+            for (size_t site = 0; site < current.size(); site++)
+            {
+                Totals &baseline = reg.baseline[site];
+                baseline.acquisitions += current[site].acquisitions;
+                baseline.contended += current[site].contended;
+                baseline.spins += current[site].spins;
+                baseline.waitNs += current[site].wait.count();
+                baseline.holdNs += current[site].hold.count();
+            }
+        };
+
+        /// Whether profiling's built in.
+        static constexpr bool enabled()             { return true; };
+
+        // What the locks call.  Not much use to anybody else.
+
+        /// The site number counts for name are kept under.
+        static size_t site(const char *name)
+        {
+            Registry &reg = registry();
+            std::lock_guard guard(reg.lock);
+            auto found = reg.ids.find(name);
+            if (found != reg.ids.end())
+            {
+                return found->second;
+            }
+            if (reg.names.size() == (LOCKPROFILE_MAX_SITES - 1))
+            {
+                reg.names.push_back("(other)");
+            }
+            if (reg.names.size() == LOCKPROFILE_MAX_SITES)
+            {
+                return LOCKPROFILE_MAX_SITES - 1;
+            }
+            reg.names.push_back(name);
+            reg.ids[name] = reg.names.size() - 1;
+            return reg.names.size() - 1;
+        };
+
+        static uint64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        };
+
+        static void acquired(size_t site, bool contended, uint64_t spins, uint64_t waitNs)
+        {
+            Counters &counters = mine().sites[site];
+            bump(counters.acquisitions, 1);
+            if (contended)
+            {
+                bump(counters.contended, 1);
+                bump(counters.spins, spins);
+                bump(counters.waitNs, waitNs);
+            }
+        };
+
+        static void released(size_t site, uint64_t holdNs)
+        {
+            bump(mine().sites[site].holdNs, holdNs);
+        };
+
+    private:
+        struct Totals
+        {
+            uint64_t acquisitions = 0;
+            uint64_t contended = 0;
+            uint64_t spins = 0;
+            uint64_t waitNs = 0;
+            uint64_t holdNs = 0;
+        };
+
+        // Atomic only so the report can read them while they're being
+        // written; only the owning thread ever writes.
+        struct Counters
+        {
+            std::atomic<uint64_t> acquisitions{0};
+            std::atomic<uint64_t> contended{0};
+            std::atomic<uint64_t> spins{0};
+            std::atomic<uint64_t> waitNs{0};
+            std::atomic<uint64_t> holdNs{0};
+
+            void addTo(Totals& totals) const
+            {
+                totals.acquisitions += acquisitions.load(std::memory_order_relaxed);
+                totals.contended += contended.load(std::memory_order_relaxed);
+                totals.spins += spins.load(std::memory_order_relaxed);
+                totals.waitNs += waitNs.load(std::memory_order_relaxed);
+                totals.holdNs += holdNs.load(std::memory_order_relaxed);
+            };
+        };
+
+        struct ThreadCounters;
+
+        struct Registry
+        {
+            std::mutex lock;
+            std::vector<std::string> names;                 // By site
+            std::map<std::string, size_t> ids;
+            std::vector<ThreadCounters *> threads;          // Live threads' counters
+            Totals retired[LOCKPROFILE_MAX_SITES];          // Threads that have exited
+            Totals baseline[LOCKPROFILE_MAX_SITES];         // As of the last reset()
+        };
+
+        // One thread's counters.  Signs up with the registry when the thread
+        // first takes a lock, and leaves its counts behind when it exits.
+        struct ThreadCounters
+        {
+            Counters sites[LOCKPROFILE_MAX_SITES];
+
+            ThreadCounters()
+            {
+                Registry &reg = registry();
+                std::lock_guard guard(reg.lock);
+                reg.threads.push_back(this);
+            };
+
+            ~ThreadCounters()
+            {
+                Registry &reg = registry();
+                std::lock_guard guard(reg.lock);
+                for (size_t site = 0; site < LOCKPROFILE_MAX_SITES; site++)
+                {
+                    sites[site].addTo(reg.retired[site]);
+                }
+                reg.threads.erase(std::find(reg.threads.begin(), reg.threads.end(), this));
+            };
+        };
+
+        // Never destroyed, so a thread exiting during static teardown still
+        // has somewhere to leave its counts.
+        static Registry& registry()
+        {
+            static Registry *reg = new Registry;
+            return *reg;
+        };
+
+        static ThreadCounters& mine()
+        {
+            static thread_local ThreadCounters counters;
+            return counters;
+        };
+
+        // Only our own thread writes these, so no read-modify-write needed.
+        static void bump(std::atomic<uint64_t>& counter, uint64_t by)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+        };
+};
+
+
+/// What a profiled lock carries around: which name it counts against and
+/// when it was last taken.
+class LockProbe
+{
+    public:
+        LockProbe(const char *name) : m_site(LockProfile::site(name)), m_taken(0) {};
+
+        void profile_as(const char *name)           { m_site.store(LockProfile::site(name), std::memory_order_relaxed); };
+
+        /// Call with the lock just taken.  asked is when lock() was called,
+        /// if it had to wait.
+        void acquired(bool contended, uint64_t spins, uint64_t asked)
+        {
+            m_taken = LockProfile::now();
+            LockProfile::acquired(m_site.load(std::memory_order_relaxed), contended, spins, contended ? (m_taken - asked) : 0);
+        };
+
+        /// Call with the lock about to be let go.
+        void released()
+        {
+            LockProfile::released(m_site.load(std::memory_order_relaxed), LockProfile::now() - m_taken);
+        };
+
+    private:
+        std::atomic<size_t> m_site;
+        uint64_t m_taken;                           // Only touched by whoever holds the lock
+};
+
+
+/// Wraps any Lockable so it's profiled.  It can't see inside the lock, so
+/// waits are counted but spins aren't.
+template <typename L> class LockProfiled : public NONCOPY
+{
+    public:
+        LockProfiled(const char *name = "(unnamed)") : m_probe(name) {};
+
+        void lock()
+        {
+            if (m_lock.try_lock())
+            {
+                m_probe.acquired(false, 0, 0);
+                return;
+            }
+            uint64_t asked = LockProfile::now();
+            m_lock.lock();
+            m_probe.acquired(true, 0, asked);
+        };
+
+        bool try_lock()
+        {
+            if (!m_lock.try_lock())
+            {
+                return false;
+            }
+            m_probe.acquired(false, 0, 0);
+            return true;
+        };
+
+        void unlock()
+        {
+            m_probe.released();
+            m_lock.unlock();
+        };
+
+        void profile_as(const char *name)           { m_probe.profile_as(name); };
+
+    private:
+        template <typename, typename> friend class ProfiledCondition;
+
+        L m_lock;
+        LockProbe m_probe;
+};
+
+
+/// Waits with a LockProfiled<L> on L's own condition variable (Cond), by
+/// waiting on the lock inside.  condition_variable_any would do it with a
+/// std::mutex of its own, which for a PI_MUTEX brings the priority
+/// inversion straight back.  Time asleep isn't counted as held, and each
+/// wake-up counts as an acquisition.
+template <typename L, typename Cond> class ProfiledCondition : public NONCOPY
+{
+    public:
+        typedef std::unique_lock<LockProfiled<L>> Lock;
+
+        ProfiledCondition() {};
+
+        void notify_one()                           { m_cond.notify_one(); };
+        void notify_all()                           { m_cond.notify_all(); };
+
+        void wait(Lock& lock)
+        {
+            inside(lock, [&](std::unique_lock<L>& inner) { m_cond.wait(inner); });
+        };
+
+        template <typename Predicate> void wait(Lock& lock, Predicate pred)
+        {
+            while (!pred())
+            {
+                wait(lock);
+            }
+        };
+
+        template <typename Clock, typename Duration>
+            std::cv_status wait_until(Lock& lock, const std::chrono::time_point<Clock, Duration>& deadline)
+        {
+            return inside(lock, [&](std::unique_lock<L>& inner) { return m_cond.wait_until(inner, deadline); });
+        };
+
+        template <typename Clock, typename Duration, typename Predicate>
+            bool wait_until(Lock& lock, const std::chrono::time_point<Clock, Duration>& deadline, Predicate pred)
+        {
+            while (!pred())
+            {
+                if (wait_until(lock, deadline) == std::cv_status::timeout)
+                {
+                    return pred();
+                }
+            }
+            return true;
+        };
+
+        template <typename Rep, typename Period>
+            std::cv_status wait_for(Lock& lock, const std::chrono::duration<Rep, Period>& timeout)
+        {
+            return inside(lock, [&](std::unique_lock<L>& inner) { return m_cond.wait_for(inner, timeout); });
+        };
+
+        template <typename Rep, typename Period, typename Predicate>
+            bool wait_for(Lock& lock, const std::chrono::duration<Rep, Period>& timeout, Predicate pred)
+        {
+            return wait_until(lock, std::chrono::steady_clock::now() + timeout, std::move(pred));
+        };
+
+    private:
+        // Runs wait(inner) on the wrapper's own lock, with the probe told it
+        // was let go for the duration.  The waits all hand the lock back
+        // before returning or throwing, so the wrapper's still held after.
+        template <typename F> auto inside(Lock& lock, F wait)
+        {
+            LockProfiled<L> &outer = *lock.mutex();
+            struct Rewrap
+            {
+                LockProfiled<L> &outer;
+                std::unique_lock<L> inner;
+
+                ~Rewrap()
+                {
+                    inner.release();
+                    outer.m_probe.acquired(false, 0, 0);
+                }
+            } rewrap{ outer, std::unique_lock<L>(outer.m_lock, std::adopt_lock) };
+
+            outer.m_probe.released();
+            return wait(rewrap.inner);
+        };
+
+        Cond m_cond;
+};
+
+// A wrapped lock waits on whatever its inner lock would, unless that's
+// condition_variable_any anyway- that one takes the wrapper as it is.
+template <typename L> struct LockCondition<LockProfiled<L>>
+{
+    using type = std::conditional_t<std::is_same_v<typename LockCondition<L>::type, std::condition_variable_any>,
+                                    std::condition_variable_any, ProfiledCondition<L, typename LockCondition<L>::type>>;
+};
+
+// Locks that do their own profiling, and don't need wrapping.
+class AtomicMtx;
+template <typename L> struct LockProfilesItself : std::false_type {};
+template <> struct LockProfilesItself<AtomicMtx> : std::true_type {};
+
+/// The lock type the containers actually hold for a Lock parameter.
+template <typename L> using ProfiledLock = std::conditional_t<LockProfilesItself<L>::value, L, LockProfiled<L>>;
+
+// Names lock X (a ProfiledLock or AtomicMtx) N for the profile.
+#define LOCKPROFILE_NAME(X, N) (X).profile_as(N)
+
+#else
+
+template <typename L> using ProfiledLock = L;
+
+#define LOCKPROFILE_NAME(X, N) ((void) (N))
+
+class LockProfile
+{
+    public:
+        enum SortBy { WAIT, HOLD, CONTENDED, ACQUISITIONS };
+
+        static void report(FILE *out = stderr, size_t count = 10, SortBy by = WAIT)
+        {
+            (void) count;
+            (void) by;
+            fprintf(out, "Lock profile: not built in (define RPE_LOCK_PROFILE)\n");
+        };
+
+        static void reset()                         {};
+
+        static constexpr bool enabled()             { return false; };
+};
+
+#endif
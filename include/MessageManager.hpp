@@ -63,10 +63,15 @@ using std::mutex;
 using std::lock_guard;
 #endif
 
+#include "LockProfile.hpp"
 #include "Singleton.hpp"
 
-template<typename T>
-class MessageManager : public Singleton<MessageManager>
+// Each slot's queue is guarded by a LockPolicy lock- the platform mutex
+// (TinyThread++'s, with USE_TINYTHREAD) unless you pick another from
+// LockPolicy.hpp.  With RPE_LOCK_PROFILE defined, they all show up in the
+// LockProfile as MessageManager.
+template<typename T, typename LockPolicy = mutex>
+class MessageManager : public Singleton<MessageManager<T, LockPolicy>>
 {
 public:
 	MessageManager() : _maxSlots(50) {};
@@ -123,7 +128,7 @@ public:
 		if (_mailbox.size() <= _maxSlots)
 		{
 			retVal = true;
-			lock_guard<mutex> msg_lock(_mailbox[slot]._lock);
+			lock_guard<ProfiledLock<LockPolicy>> msg_lock(_mailbox[slot]._lock);
 			_mailbox[slot]._queue.push(msg);
 			// Mutex is released as soon as we leave scope here...
 		}
@@ -154,7 +159,7 @@ public:
 			if (!_mailbox[slot]._queue.empty())
 			{
 				// Fetch out an entry from the queue...
-				lock_guard<mutex> msg_lock(_mailbox[slot]._lock);
+				lock_guard<ProfiledLock<LockPolicy>> msg_lock(_mailbox[slot]._lock);
 				retVal = true;
 				msg = _mailbox[slot]._queue.front();
 				_mailbox[slot]._queue.pop();
@@ -168,11 +173,13 @@ public:
 
 private:
 	typedef queue<T> msg_queue;
-	typedef struct
+	struct mailbox_queue
 	{
-		mutex		_lock;
+		ProfiledLock<LockPolicy>	_lock;
 		msg_queue	_queue;
-	} mailbox_queue;
+
+		mailbox_queue() { LOCKPROFILE_NAME(_lock, "MessageManager"); };
+	};
 	typedef pair<const int, mailbox_queue> mailbox_slot;
 	typedef map<const int, mailbox_queue> mailbox;
 
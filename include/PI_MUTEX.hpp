@@ -0,0 +1,267 @@
+/*
+ * PI_MUTEX.hpp
+ *
+ * Priority-inheritance mutex (and condition variable to go with it) for
+ * locks shared between real-time and ordinary threads.
+ *
+ * Copyright (c) 2013-2024 Frank C. Earl, All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.  You may add your
+ *    own copyright notice relative to your modifications, but you cannot claim
+ *    the code herein as solely your own.
+ *
+ * 2. Binary redistributions must reproduce the above copyright notice, either
+ *    in the initial output of the derived application, a "help" screen, or in
+ *    the documentation that accompanies the same.
+ *
+ * 3. Neither the name of the copyright holder nor the names of this software's
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.  Compliance with
+ *    condition 2 does not constitute a violation of this condition.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * SPECIFICALLY DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <time.h>
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>       // cv_status
+#include <mutex>
+#include <system_error>
+#include <type_traits>
+
+#include <LockCondition.hpp>
+#include <NONCOPY.hpp>
+
+
+/*
+	The classic priority inversion: a SCHED_FIFO control thread blocks on a
+	lock a normal priority thread holds, and that thread can't run to let go
+	of it because everything in between outranks it.  The RT thread waits on
+	the scheduler, not on the work, sometimes for milliseconds.
+
+	PI_MUTEX is a pthread mutex with PTHREAD_PRIO_INHERIT set.  While
+	somebody higher priority is waiting on it, the holder runs at the
+	waiter's priority, so it gets to finish up and hand the lock over.  On
+	Linux that's a PI futex: uncontended it never enters the kernel, same as
+	std::mutex.
+
+	It's a Lockable, so lock_guard, unique_lock and ATOMIC_LCK work, and it
+	goes in as the Lock parameter of TSQueue, TSPriorityQueue, TSShardedQueue,
+	TSMultiQueue or MessageManager.  The containers wait on a PI_CONDITION
+	with it rather than a std::condition_variable_any- the _any one keeps
+	a plain std::mutex of its own, which would put the inversion right back.
+	That holds under RPE_LOCK_PROFILE too, where they wait through the
+	profiling wrapper on the PI_MUTEX inside it.
+
+	Constructing one throws std::system_error if the platform doesn't do
+	priority inheritance.
+*/
+class PI_MUTEX : public NONCOPY
+{
+    public:
+        /// Default constructor.
+        PI_MUTEX()
+        {
+            pthread_mutexattr_t attr;
+            int err = pthread_mutexattr_init(&attr);
+            if (err == 0)
+            {
+                err = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+                if (err == 0)
+                {
+                    err = pthread_mutex_init(&m_mutex, &attr);
+                }
+                pthread_mutexattr_destroy(&attr);
+            }
+            if (err != 0)
+            {
+                throw std::system_error(err, std::system_category(), "PI_MUTEX");
+            }
+        };
+
+        ~PI_MUTEX()                                 { pthread_mutex_destroy(&m_mutex); };
+
+        /// Locks the mutex.
+        void lock()
+        {
+            int err = pthread_mutex_lock(&m_mutex);
+            if (err != 0)
+            {
+                throw std::system_error(err, std::system_category(), "PI_MUTEX");
+            }
+        };
+
+        /// Tries to lock the mutex without waiting.  Returns true if we got it.
+        bool try_lock()                             { return pthread_mutex_trylock(&m_mutex) == 0; };
+
+        /// Unlocks the mutex.
+        void unlock()                               { pthread_mutex_unlock(&m_mutex); };
+
+        pthread_mutex_t* native_handle()            { return &m_mutex; };
+
+    private:
+        pthread_mutex_t m_mutex;
+};
+
+
+/// A condition variable that waits with a PI_MUTEX, the way
+/// std::condition_variable waits with a std::mutex.  Timed waits are
+/// against CLOCK_MONOTONIC, so setting the wall clock doesn't upset them.
+class PI_CONDITION : public NONCOPY
+{
+    public:
+        PI_CONDITION()
+        {
+            pthread_condattr_t attr;
+            int err = pthread_condattr_init(&attr);
+            if (err == 0)
+            {
+                err = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+                if (err == 0)
+                {
+                    err = pthread_cond_init(&m_cond, &attr);
+                }
+                pthread_condattr_destroy(&attr);
+            }
+            if (err != 0)
+            {
+                throw std::system_error(err, std::system_category(), "PI_CONDITION");
+            }
+        };
+
+        ~PI_CONDITION()                             { pthread_cond_destroy(&m_cond); };
+
+        void notify_one()                           { pthread_cond_signal(&m_cond); };
+        void notify_all()                           { pthread_cond_broadcast(&m_cond); };
+
+        void wait(std::unique_lock<PI_MUTEX>& lock)
+        {
+            pthread_cond_wait(&m_cond, lock.mutex()->native_handle());
+        };
+
+        template <typename Predicate> void wait(std::unique_lock<PI_MUTEX>& lock, Predicate pred)
+        {
+            while (!pred())
+            {
+                wait(lock);
+            }
+        };
+
+        template <typename Clock, typename Duration>
+            std::cv_status wait_until(std::unique_lock<PI_MUTEX>& lock, const std::chrono::time_point<Clock, Duration>& deadline)
+        {
+            // steady_clock is CLOCK_MONOTONIC; anything else gets converted.
+            // Either way, a deadline too far out to represent (max(), say)
+            // becomes the furthest one there is rather than wrapping into
+            // the past and returning straight away.
+            std::chrono::steady_clock::time_point steadyDeadline;
+            if constexpr (std::is_same_v<Clock, std::chrono::steady_clock>)
+            {
+                steadyDeadline = std::chrono::steady_clock::time_point(saturate(deadline.time_since_epoch()));
+            }
+            else
+            {
+                typename Clock::time_point now = Clock::now();
+                steadyDeadline = after((deadline > now) ? saturate(deadline - now) : std::chrono::steady_clock::duration::zero());
+            }
+
+            std::chrono::nanoseconds since = std::chrono::duration_cast<std::chrono::nanoseconds>(steadyDeadline.time_since_epoch());
+            if (since.count() < 0)
+            {
+                since = std::chrono::nanoseconds(0);
+            }
+            struct timespec abstime;
+            abstime.tv_sec = since.count() / 1000000000;
+            abstime.tv_nsec = since.count() % 1000000000;
+            pthread_cond_timedwait(&m_cond, lock.mutex()->native_handle(), &abstime);
+            return (Clock::now() < deadline) ? std::cv_status::no_timeout : std::cv_status::timeout;
+        };
+
+        template <typename Clock, typename Duration, typename Predicate>
+            bool wait_until(std::unique_lock<PI_MUTEX>& lock, const std::chrono::time_point<Clock, Duration>& deadline, Predicate pred)
+        {
+            while (!pred())
+            {
+                if (wait_until(lock, deadline) == std::cv_status::timeout)
+                {
+                    return pred();
+                }
+            }
+            return true;
+        };
+
+        template <typename Rep, typename Period>
+            std::cv_status wait_for(std::unique_lock<PI_MUTEX>& lock, const std::chrono::duration<Rep, Period>& timeout)
+        {
+            return wait_until(lock, after(saturate(timeout)));
+        };
+
+        template <typename Rep, typename Period, typename Predicate>
+            bool wait_for(std::unique_lock<PI_MUTEX>& lock, const std::chrono::duration<Rep, Period>& timeout, Predicate pred)
+        {
+            return wait_until(lock, after(saturate(timeout)), std::move(pred));
+        };
+
+        pthread_cond_t* native_handle()             { return &m_cond; };
+
+    private:
+        // d in steady_clock's units, pinned at the ends of its range
+        // instead of overflowing.
+        template <typename Rep, typename Period>
+            static std::chrono::steady_clock::duration saturate(const std::chrono::duration<Rep, Period>& d)
+        {
+            typedef std::chrono::steady_clock::duration Steady;
+            typedef std::chrono::duration<double> Seconds;
+            if (Seconds(d) >= Seconds(Steady::max()))
+            {
+                return Steady::max();
+            }
+            if (Seconds(d) <= Seconds(Steady::min()))
+            {
+                return Steady::min();
+            }
+            return std::chrono::duration_cast<Steady>(d);
+        };
+
+        // Now plus timeout, pinned at time_point::max() instead of wrapping.
+        static std::chrono::steady_clock::time_point after(std::chrono::steady_clock::duration timeout)
+        {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (timeout <= std::chrono::steady_clock::duration::zero())
+            {
+                return now;
+            }
+            if (timeout >= (std::chrono::steady_clock::time_point::max() - now))
+            {
+                return std::chrono::steady_clock::time_point::max();
+            }
+            return now + timeout;
+        };
+
+        pthread_cond_t m_cond;
+};
+
+template <> struct LockCondition<PI_MUTEX>
+{
+    using type = PI_CONDITION;
+};
@@ -0,0 +1,170 @@
+/*
+ * RWSpinMtx.hpp
+ *
+ * Reader-writer spinlock to go alongside AtomicMtx for state that's read
+ * far more often than it's written.
+ *
+ * Copyright (c) 2013-2024 Frank C. Earl, All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.  You may add your
+ *    own copyright notice relative to your modifications, but you cannot claim
+ *    the code herein as solely your own.
+ *
+ * 2. Binary redistributions must reproduce the above copyright notice, either
+ *    in the initial output of the derived application, a "help" screen, or in
+ *    the documentation that accompanies the same.
+ *
+ * 3. Neither the name of the copyright holder nor the names of this software's
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.  Compliance with
+ *    condition 2 does not constitute a violation of this condition.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * SPECIFICALLY DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>            // lock_guard...
+#include <shared_mutex>     // ...and shared_lock
+
+#include <AtomicMtx.hpp>
+#include <NONCOPY.hpp>
+
+
+/*
+	AtomicMtx and std::mutex let one thread in at a time, readers included.
+	For things like the current GPIO levels or a port's Settings, which get
+	looked at constantly and changed once in a blue moon, the readers end up
+	queueing behind each other for no reason.
+
+	RWSpinMtx lets any number of readers in together (lock_shared()) or one
+	writer on its own (lock()).  It's a SharedLockable, so std::shared_lock
+	works for the read side and lock_guard/unique_lock/ATOMIC_LCK for the
+	write side; RWSPIN_READ_LCK below is the read side's ATOMIC_LCK.
+
+	Writers get preference: once one's waiting, new readers hold off until
+	it's been in and out, so a steady stream of readers can't lock writers
+	out forever.  (The flip side is that a steady stream of writers can lock
+	the readers out, but if that's your load, this is the wrong lock.)
+
+	Every reader still does an atomic add and subtract on the one shared
+	word, so the cache line it lives on bounces between the reading cores.
+	If the readers only need a copy of a small, plain struct, SeqLocked's
+	readers don't write anything at all and scale better still.
+
+	Same provisos as AtomicMtx- no re-grabbing it, and no upgrading a read
+	lock to a write lock (let go and take the write lock).
+*/
+class RWSpinMtx : public NONCOPY
+{
+    public:
+        /// Default constructor.
+        RWSpinMtx() : m_state(0) {};
+
+        /// Locks the mutex for writing- waits for the readers to drain out.
+        void lock()
+        {
+            SpinBackoff backoff;
+            for (;;)
+            {
+                uint32_t state = m_state.load(std::memory_order_relaxed);
+                if ((state & ~WAITING) == 0)
+                {
+                    // Nobody's in.  Taking it clears WAITING; any other writer
+                    // still waiting sets it again next time around.
+                    if (m_state.compare_exchange_weak(state, WRITER, std::memory_order_acquire, std::memory_order_relaxed))
+                    {
+                        return;
+                    }
+                    continue;
+                }
+                if ((state & WAITING) == 0)
+                {
+                    // Keep new readers out so the ones in there drain.
+                    m_state.fetch_or(WAITING, std::memory_order_relaxed);
+                }
+                backoff.pause();
+            }
+        };
+
+        /// Tries to lock the mutex for writing without waiting.  Returns true
+        /// if we got it.
+        bool try_lock()
+        {
+            uint32_t state = m_state.load(std::memory_order_relaxed);
+            return ((state & ~WAITING) == 0) &&
+                   m_state.compare_exchange_strong(state, WRITER, std::memory_order_acquire, std::memory_order_relaxed);
+        };
+
+        /// Unlocks the write lock.
+        void unlock()
+        {
+            // Leaves WAITING alone- another writer may have set it meanwhile.
+            m_state.fetch_and(~WRITER, std::memory_order_release);
+        };
+
+        /// Locks the mutex for reading, alongside any other readers.
+        void lock_shared()
+        {
+            if (!try_lock_shared())
+            {
+                SpinBackoff backoff;
+                do
+                {
+                    backoff.pause();
+                } while (!try_lock_shared());
+            }
+        };
+
+        /// Tries to lock the mutex for reading without waiting.  Returns true
+        /// if we got it.
+        bool try_lock_shared()
+        {
+            uint32_t state = m_state.load(std::memory_order_relaxed);
+            while ((state & (WRITER | WAITING)) == 0)
+            {
+                // Only another reader coming or going can make this fail, so
+                // keep at it.
+                if (m_state.compare_exchange_weak(state, state + 1, std::memory_order_acquire, std::memory_order_relaxed))
+                {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        /// Unlocks a read lock.
+        void unlock_shared()
+        {
+            m_state.fetch_sub(1, std::memory_order_release);
+        };
+
+    private:
+        // Top bit is the writer, the next one down says a writer's waiting,
+        // and the rest count readers.
+        static const uint32_t WRITER = 0x80000000u;
+        static const uint32_t WAITING = 0x40000000u;
+
+        std::atomic<uint32_t> m_state;
+};
+
+// Read-locks X until the end of the enclosing scope.  ATOMIC_LCK(X) is the
+// write side.
+#define RWSPIN_READ_LCK(X) std::shared_lock<std::remove_reference_t<decltype(X)>> X_rdlck(X)
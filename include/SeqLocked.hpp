@@ -0,0 +1,165 @@
+/*
+ * SeqLocked.hpp
+ *
+ * Sequence-locked value for small, plain state that's read constantly and
+ * written rarely.
+ *
+ * Copyright (c) 2013-2024 Frank C. Earl, All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.  You may add your
+ *    own copyright notice relative to your modifications, but you cannot claim
+ *    the code herein as solely your own.
+ *
+ * 2. Binary redistributions must reproduce the above copyright notice, either
+ *    in the initial output of the derived application, a "help" screen, or in
+ *    the documentation that accompanies the same.
+ *
+ * 3. Neither the name of the copyright holder nor the names of this software's
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.  Compliance with
+ *    condition 2 does not constitute a violation of this condition.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * SPECIFICALLY DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include <AtomicMtx.hpp>
+#include <CacheLine.hpp>
+#include <NONCOPY.hpp>
+
+
+/*
+	A seqlock: the value sits alongside a sequence number that the writer
+	bumps to odd before it changes anything and back to even once it's done.
+	A reader notes the sequence, copies the value out, and checks the
+	sequence again- if it was odd, or moved, a write got in the way and the
+	reader just copies again.
+
+	What that buys over a lock, reader-writer or otherwise:
+
+		- Readers never write to shared memory.  They don't fight over a
+		  cache line with each other, so a hundred readers cost about what
+		  one does.
+		- The writer never waits, for anything.  store() is a fixed number
+		  of plain stores no matter how many readers are in the middle of a
+		  load().
+
+	The costs: a reader can have to retry while a store() is going on, and
+	it always gets a copy rather than a reference.  So it's for values that
+	are small and trivially copyable (the GPIO levels, a port's Settings, a
+	handful of config fields) and read far more than written.
+
+	store() is for one writer at a time.  If more than one thread can write,
+	serialize them yourself (an AtomicMtx held around the store() will do);
+	the readers don't care either way.
+
+	The value's kept as an array of atomic words rather than a plain T, so a
+	reader copying it while the writer's changing it is a (retried) stale
+	read and not a data race.
+*/
+template <typename T> class SeqLocked : public NONCOPY
+{
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLocked needs a trivially copyable type");
+
+    public:
+        /// Constructor- starts with a value-initialized T.
+        SeqLocked() : m_sequence(0)                 { write(T()); };
+
+        /// Constructor- starts with value.
+        SeqLocked(const T& value) : m_sequence(0)   { write(value); };
+
+        /// Hands back a consistent copy of the value, retrying if a store()
+        /// was going on while we copied.
+        T load() const
+        {
+            T retVal;
+            while (!try_load(retVal))
+            {
+                cpuRelax();
+            }
+            return retVal;
+        };
+
+        /// One attempt at load().  Returns false, leaving value in an
+        /// unspecified state, if a store() got in the way.
+        bool try_load(T& value) const
+        {
+            uint32_t before = m_sequence.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                return false;
+            }
+            Word words[Words];
+            for (size_t i = 0; i < Words; i++)
+            {
+                words[i] = m_words[i].load(std::memory_order_relaxed);
+            }
+            // Keep the copy from sinking below the second look.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_sequence.load(std::memory_order_relaxed) != before)
+            {
+                return false;
+            }
+            std::memcpy(&value, words, sizeof(T));
+            return true;
+        };
+
+        /// Replaces the value.  One writer at a time.
+        void store(const T& value)
+        {
+            uint32_t sequence = m_sequence.load(std::memory_order_relaxed);
+            m_sequence.store(sequence + 1, std::memory_order_relaxed);
+            // Keep the value's stores from rising above the odd sequence.
+            std::atomic_thread_fence(std::memory_order_release);
+            write(value);
+            m_sequence.store(sequence + 2, std::memory_order_release);
+        };
+
+        /// Changes the value with f(T&), read-modify-write.  One writer at a
+        /// time, same as store().
+        template <typename F> void update(F f)
+        {
+            T value = load();
+            f(value);
+            store(value);
+        };
+
+    private:
+        typedef uintptr_t Word;
+        static const size_t Words = (sizeof(T) + sizeof(Word) - 1) / sizeof(Word);
+
+        void write(const T& value)
+        {
+            Word words[Words] = {};
+            std::memcpy(words, &value, sizeof(T));
+            for (size_t i = 0; i < Words; i++)
+            {
+                m_words[i].store(words[i], std::memory_order_relaxed);
+            }
+        };
+
+        alignas(CACHELINE_SIZE) std::atomic<uint32_t> m_sequence;  // Odd while a store() is under way
+        std::atomic<Word> m_words[Words];
+};
@@ -0,0 +1,159 @@
+/*
+ * ShardedSingleton.hpp
+ *
+ * A Singleton with one instance per thread, for the ones that are really just
+ * accumulators- stats, free lists, scratch buffers.  With one instance behind a
+ * mutex, every thread that touches it lines up behind every other one.  Here
+ * each thread's GetInstance() hands back its own instance (its "shard"), on its
+ * own cache line, with no locking at all, and the shards are pulled together
+ * only when somebody asks:
+ *
+ *     class FrameStats : public ShardedSingleton<FrameStats>
+ *     {
+ *     public:
+ *         std::atomic<uint64_t> frames{0};
+ *     };
+ *
+ *     FrameStats::GetInstance()->frames++;             // Hot path, this thread's shard
+ *
+ *     uint64_t total = FrameStats::combine(uint64_t(0),   // Every thread's, added up
+ *         [](uint64_t sum, const FrameStats& stats) { return sum + stats.frames.load(); });
+ *
+ * for_each() and combine() run while the owning threads may still be writing,
+ * so anything they read should be a relaxed atomic (or only looked at once the
+ * writers are quiet).  The write path itself never shares a cache line.
+ *
+ * When a thread exits, its shard isn't thrown away- its counts still count- it
+ * goes on a spare list and the next new thread picks it up.  So there are only
+ * ever as many shards as the most threads that have used it at once, and a
+ * thread can start out with someone else's leftovers.
+ *
+ * ThreadLocalSingleton is the same thing by another name.
+ */
+#pragma once
+
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <CacheLine.hpp>
+
+template<class T> class ShardedSingleton
+{
+public:
+	/// Return a pointer to this thread's instance of this class.
+	///
+	/// The instance is created (or a spare one handed over) on the thread's
+	/// first call, and only this thread gets it until the thread exits.
+	///
+	/// @return A pointer to this thread's instance of this class.
+	static T* GetInstance()
+	{
+		T *instance = _mine;
+		return (instance != NULL) ? instance : attach();
+	}
+
+	/// Calls f(T&) on every thread's instance, including spares left by
+	/// threads that have exited.
+	template<typename F> static void for_each(F f)
+	{
+		Registry &reg = registry();
+		std::lock_guard<std::mutex> guard(reg.lock);
+		for (Shard *shard : reg.shards)
+		{
+			f(shard->value);
+		}
+	}
+
+	/// Folds every instance into init with op(R, const T&), and returns
+	/// the result.
+	template<typename R, typename Op> static R combine(R init, Op op)
+	{
+		for_each([&](T& value) { init = op(std::move(init), value); });
+		return init;
+	}
+
+	/// Adds every instance up into a fresh T with T's operator+=, for a T
+	/// that can be copied.
+	static T combine()
+	{
+		T retVal;
+		for_each([&](T& value) { retVal += value; });
+		return retVal;
+	}
+
+	/// How many instances there are.
+	static size_t shards()
+	{
+		Registry &reg = registry();
+		std::lock_guard<std::mutex> guard(reg.lock);
+		return reg.shards.size();
+	}
+
+private:
+	struct alignas(CACHELINE_SIZE) Shard
+	{
+		T value;
+	};
+
+	struct Registry
+	{
+		std::mutex lock;
+		std::vector<Shard *> shards;		// Every one there is
+		std::vector<Shard *> spare;		// Left by threads that have exited
+	};
+
+	// Hands this thread's shard back when the thread exits.
+	struct Holder
+	{
+		Shard *shard = NULL;
+
+		~Holder()
+		{
+			if (shard != NULL)
+			{
+				_mine = NULL;
+				Registry &reg = registry();
+				std::lock_guard<std::mutex> guard(reg.lock);
+				reg.spare.push_back(shard);
+			}
+		}
+	};
+
+	// Never destroyed, shards and all: a thread can still be exiting, and
+	// handing its shard back, after static destructors have run.
+	static Registry& registry()
+	{
+		static Registry *reg = new Registry;
+		return *reg;
+	}
+
+	static T* attach()
+	{
+		Registry &reg = registry();
+		Shard *shard = NULL;
+		{
+			std::lock_guard<std::mutex> guard(reg.lock);
+			if (!reg.spare.empty())
+			{
+				shard = reg.spare.back();
+				reg.spare.pop_back();
+			}
+		}
+		if (shard == NULL)
+		{
+			shard = new Shard();
+			std::lock_guard<std::mutex> guard(reg.lock);
+			reg.shards.push_back(shard);
+		}
+		_holder.shard = shard;
+		_mine = &shard->value;
+		return _mine;
+	}
+
+	// Two thread_locals so the fast path is a plain load: _mine has no
+	// destructor to guard, _holder is only touched on the way in and out.
+	static inline thread_local T *_mine = NULL;
+	static inline thread_local Holder _holder;
+};
+
+template<class T> using ThreadLocalSingleton = ShardedSingleton<T>;
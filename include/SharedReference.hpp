@@ -50,6 +50,7 @@
 
 // NOTE: This *requires* C++11 compliance in your compiler to use this configuration.
 #include <memory>
+#include <utility>
 using std::shared_ptr;
 using std::addressof;
 
@@ -60,14 +61,31 @@ template <typename T>
 class SharedReference
 {
 public:
-	SharedReference()  		{ SharedReference::reset(new T()); };		// In order to make containers like std::map happy, you have to do this...
+	SharedReference() : _ptr(std::make_shared<T>()) {};				// In order to make containers like std::map happy, you have to do this...
 	SharedReference(T &ref)	{ SharedReference::reset(ref); };
 	SharedReference(T *ptr)	{ SharedReference::reset(ptr); };
 	template<typename U>
 		SharedReference(shared_ptr<U> &sp_ref) { SharedReference::reset(sp_ref); };
 
+	// Copies share the object; moves just hand the pointer over, with no
+	// refcount traffic.  A moved-from SharedReference holds nothing- only
+	// assign to it or let it go.
+	SharedReference(const SharedReference &other) = default;
+	SharedReference(SharedReference &&other) noexcept = default;
+	SharedReference& operator=(const SharedReference &other) = default;
+	SharedReference& operator=(SharedReference &&other) noexcept = default;
+
 	~SharedReference() {};
 
+	// Factories - build the T in place, in the same allocation as the
+	//			   shared_ptr's control block, instead of one for each.
+	template<typename... Args>
+		static SharedReference make(Args&&... args)
+			{ return SharedReference(Owned(), std::make_shared<T>(std::forward<Args>(args)...)); };
+	template<typename Alloc, typename... Args>
+		static SharedReference allocate(const Alloc &alloc, Args&&... args)
+			{ return SharedReference(Owned(), std::allocate_shared<T>(alloc, std::forward<Args>(args)...)); };
+
 	// Re-setters - if you pass a value or reference of the specified type, it will
 	// 				do a copy into the
 	void reset(T &ref)	{ _ptr.reset(addressof(ref)); };		// *Must* assume it's safe to enclose this.
@@ -92,6 +110,9 @@ public:
 		SharedReference& operator=(shared_ptr<U> &sp_ref) { SharedReference::reset(sp_ref); return *this; };
 
 private:
+	struct Owned {};
+	SharedReference(Owned, shared_ptr<T> &&sp) : _ptr(std::move(sp)) {};
+
 	shared_ptr<T>	  _ptr;
 };
 
@@ -5,6 +5,9 @@
  * This uses the Meyers model and should be intrinsically safe for most uses.  Care
  * should be taken to avoid a dependency loop in Singletons.  This will cause you 
  * to have a race condition in your program and therefore a segfault.
+ *
+ * If construction order (or cost) matters, see RegisteredSingleton in
+ * SingletonRegistry.hpp- declared dependencies, built up front, torn down in order.
  */
 #pragma once
 
@@ -0,0 +1,428 @@
+/*
+ * SingletonRegistry.hpp
+ *
+ * Opt-in, ordered startup and teardown for Singletons.  Each one declares the
+ * Singletons it depends on; SingletonRegistry::Startup() then builds them all
+ * up front, independent ones in parallel, dependencies first, and Shutdown()
+ * takes them down again in the reverse order.  No more paying for a dozen lazy
+ * constructions (GPIO lines, serial ports...) on the first frame, and a
+ * dependency loop is an exception at startup instead of a segfault.
+ *
+ *     class SerialPort : public RegisteredSingleton<SerialPort, Settings> { ... };
+ *     REGISTER_SINGLETON(SerialPort);
+ *
+ *     int main()
+ *     {
+ *         SingletonRegistry::Startup();
+ *         ...
+ *         SingletonRegistry::Shutdown();
+ *     }
+ *
+ * GetInstance() works as it always has, and still builds the instance (and
+ * its dependencies) on the spot if Startup() hasn't got to it yet.  After
+ * Shutdown(), it hands back NULL.  Dependencies can be plain Singletons too;
+ * those just get built on demand, before whatever needs them.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <typeindex>
+#include <typeinfo>
+#include <vector>
+#include <NONCOPY.hpp>
+
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#include <cstdlib>
+#endif
+
+class SingletonRegistry;
+
+// Lets the registry tell registered Singletons from plain ones.
+class RegisteredSingletonBase
+{
+};
+
+template<class T, class... Deps> class RegisteredSingleton : public RegisteredSingletonBase, public NONCOPY
+{
+public:
+	/// Return a pointer to the single instance of this class.
+	///
+	/// Builds the instance, dependencies first, if nobody has yet.  Returns
+	/// NULL once SingletonRegistry::Shutdown() has torn it down.
+	///
+	/// @return A pointer to the single instance of this class.
+	static T* GetInstance()
+	{
+		T *instance = _instance.load(std::memory_order_acquire);
+		return (instance != NULL) ? instance : build();
+	}
+
+private:
+	friend class SingletonRegistry;
+
+	static void registerWith();
+	static T* build();
+	static void destroy();
+
+	static inline std::atomic<T *> _instance{NULL};
+	static inline std::mutex _lock;
+	static inline bool _gone = false;
+};
+
+class SingletonRegistry : public NONCOPY
+{
+public:
+	/// Adds T (a RegisteredSingleton), and any registered Singletons it
+	/// depends on, to the ones Startup() builds.  Adding one twice is fine.
+	template<class T> static void Add()
+	{
+		T::registerWith();
+	}
+
+	/// Builds every registered Singleton that isn't built yet, on up to
+	/// threads threads (one per hardware thread by default).  Nothing starts
+	/// until everything it depends on is done.  Throws std::logic_error on
+	/// a dependency loop, before building anything; if a constructor throws,
+	/// that's rethrown here once the ones already under way have finished.
+	static void Startup(size_t threads = 0)
+	{
+		get().startup(threads);
+	}
+
+	/// Destroys every Singleton the registry's seen built, in the reverse
+	/// of the order they finished being built.
+	static void Shutdown()
+	{
+		get().shutdown();
+	}
+
+	~SingletonRegistry()
+	{
+		shutdown();
+	}
+
+private:
+	template<class T, class... Deps> friend class RegisteredSingleton;
+
+	struct Node
+	{
+		std::type_index type;
+		std::string name;
+		std::vector<std::type_index> deps;	// Registered dependencies only
+		std::function<void()> build;
+	};
+
+	SingletonRegistry() {};
+
+	static SingletonRegistry& get()
+	{
+		static SingletonRegistry registry;
+		return registry;
+	}
+
+	template<class T, class... Deps> void add()
+	{
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			for (const Node &node : _nodes)
+			{
+				if (node.type == std::type_index(typeid(T)))
+				{
+					return;
+				}
+			}
+			std::vector<std::type_index> deps;
+			(addDep<Deps>(deps), ...);
+			_nodes.push_back(Node{ std::type_index(typeid(T)), typeName(typeid(T)), deps, []{ T::GetInstance(); } });
+		}
+		(registerDep<Deps>(), ...);
+	}
+
+	template<class D> static void addDep(std::vector<std::type_index>& deps)
+	{
+		if constexpr (std::is_base_of_v<RegisteredSingletonBase, D>)
+		{
+			deps.push_back(std::type_index(typeid(D)));
+		}
+	}
+
+	template<class D> static void registerDep()
+	{
+		if constexpr (std::is_base_of_v<RegisteredSingletonBase, D>)
+		{
+			Add<D>();
+		}
+	}
+
+	// Readable class name, for the error messages.
+	static std::string typeName(const std::type_info& type)
+	{
+		std::string retVal = type.name();
+#if defined(__GNUG__)
+		int status = 0;
+		char *demangled = abi::__cxa_demangle(type.name(), NULL, NULL, &status);
+		if (demangled != NULL)
+		{
+			retVal = demangled;
+			free(demangled);
+		}
+#endif
+		return retVal;
+	}
+
+	// Called by each RegisteredSingleton as it finishes being built.
+	void built(void (*destroy)())
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		_teardown.push_back(destroy);
+	}
+
+	void startup(size_t threads)
+	{
+		std::vector<Node> nodes;
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			nodes = _nodes;
+		}
+
+		// Kahn's algorithm: count what each node waits on, and who's
+		// waiting on it.
+		size_t count = nodes.size();
+		std::vector<size_t> waitingOn(count, 0);
+		std::vector<std::vector<size_t>> dependents(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			for (const std::type_index &dep : nodes[i].deps)
+			{
+				for (size_t j = 0; j < count; j++)
+				{
+					if (nodes[j].type == dep)
+					{
+						waitingOn[i]++;
+						dependents[j].push_back(i);
+					}
+				}
+			}
+		}
+		checkForLoops(nodes, waitingOn, dependents);
+
+		std::vector<size_t> ready;
+		for (size_t i = 0; i < count; i++)
+		{
+			if (waitingOn[i] == 0)
+			{
+				ready.push_back(i);
+			}
+		}
+
+		if (threads == 0)
+		{
+			threads = (std::thread::hardware_concurrency() > 0) ? std::thread::hardware_concurrency() : 4;
+		}
+		threads = std::min(threads, count);
+
+		std::mutex lock;
+		std::condition_variable wakeup;
+		size_t finished = 0;
+		size_t running = 0;
+		std::exception_ptr failure;
+
+		auto worker = [&]
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			for (;;)
+			{
+				wakeup.wait(guard, [&]{ return !ready.empty() || (finished == count) || (failure && (running == 0)); });
+				if (ready.empty())
+				{
+					return;
+				}
+				size_t next = ready.back();
+				ready.pop_back();
+				running++;
+
+				guard.unlock();
+				std::exception_ptr error;
+				try
+				{
+					nodes[next].build();
+				}
+				catch (...)
+				{
+					error = std::current_exception();
+				}
+				guard.lock();
+
+				running--;
+				finished++;
+				if (error)
+				{
+					// Don't start anything new; let what's running finish.
+					if (!failure)
+					{
+						failure = error;
+					}
+					ready.clear();
+				}
+				else if (!failure)
+				{
+					for (size_t dependent : dependents[next])
+					{
+						if (--waitingOn[dependent] == 0)
+						{
+							ready.push_back(dependent);
+						}
+					}
+				}
+				wakeup.notify_all();
+			}
+		};
+
+		std::vector<std::thread> pool;
+		for (size_t i = 1; i < threads; i++)
+		{
+			pool.emplace_back(worker);
+		}
+		if (threads > 0)
+		{
+			worker();
+		}
+		for (std::thread &thread : pool)
+		{
+			thread.join();
+		}
+
+		if (failure)
+		{
+			std::rethrow_exception(failure);
+		}
+	}
+
+	// Throws if the dependencies go round in a circle.
+	static void checkForLoops(const std::vector<Node>& nodes, std::vector<size_t> waitingOn,
+							  const std::vector<std::vector<size_t>>& dependents)
+	{
+		std::vector<size_t> ready;
+		size_t done = 0;
+		for (size_t i = 0; i < nodes.size(); i++)
+		{
+			if (waitingOn[i] == 0)
+			{
+				ready.push_back(i);
+			}
+		}
+		while (!ready.empty())
+		{
+			size_t next = ready.back();
+			ready.pop_back();
+			done++;
+			for (size_t dependent : dependents[next])
+			{
+				if (--waitingOn[dependent] == 0)
+				{
+					ready.push_back(dependent);
+				}
+			}
+		}
+		if (done != nodes.size())
+		{
+			std::string names;
+			for (size_t i = 0; i < nodes.size(); i++)
+			{
+				if (waitingOn[i] > 0)
+				{
+					names += (names.empty() ? "" : ", ") + nodes[i].name;
+				}
+			}
+			throw std::logic_error("SingletonRegistry: dependency loop among " + names);
+		}
+	}
+
+	void shutdown()
+	{
+		std::vector<void (*)()> teardown;
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			teardown.swap(_teardown);
+		}
+		for (auto destroy = teardown.rbegin(); destroy != teardown.rend(); ++destroy)
+		{
+			(*destroy)();
+		}
+	}
+
+	std::mutex				_lock;
+	std::vector<Node>		_nodes;
+	std::vector<void (*)()>	_teardown;		// In the order they were built
+};
+
+// Set when a thread's in the middle of building a RegisteredSingleton, to
+// catch one that (through its dependencies) needs itself.
+template<class T> struct SingletonBuilding
+{
+	static inline thread_local bool active = false;
+};
+
+template<class T, class... Deps> void RegisteredSingleton<T, Deps...>::registerWith()
+{
+	SingletonRegistry::get().add<T, Deps...>();
+}
+
+template<class T, class... Deps> T* RegisteredSingleton<T, Deps...>::build()
+{
+	if (SingletonBuilding<T>::active)
+	{
+		throw std::logic_error("Singleton dependency loop through " + SingletonRegistry::typeName(typeid(T)));
+	}
+	SingletonBuilding<T>::active = true;
+
+	try
+	{
+		// Everything we need comes first...
+		(Deps::GetInstance(), ...);
+
+		std::lock_guard<std::mutex> guard(_lock);
+		T *instance = _instance.load(std::memory_order_relaxed);
+		if ((instance == NULL) && !_gone)
+		{
+			instance = new T;
+			_instance.store(instance, std::memory_order_release);
+			SingletonRegistry::get().built(&RegisteredSingleton::destroy);
+		}
+		SingletonBuilding<T>::active = false;
+		return instance;
+	}
+	catch (...)
+	{
+		SingletonBuilding<T>::active = false;
+		throw;
+	}
+}
+
+template<class T, class... Deps> void RegisteredSingleton<T, Deps...>::destroy()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	_gone = true;
+	delete _instance.exchange(NULL, std::memory_order_acq_rel);
+}
+
+// Signs T up with the SingletonRegistry.  Put it at file scope, next to T's
+// definition.
+template<class T> struct SingletonRegistration
+{
+	SingletonRegistration()
+	{
+		SingletonRegistry::Add<T>();
+	}
+};
+
+#define REGISTER_SINGLETON(T) static SingletonRegistration<T> T##_singletonRegistration
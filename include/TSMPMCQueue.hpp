@@ -0,0 +1,288 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <thread>
+
+#include <CacheLine.hpp>
+
+// Implement a lock-free, bounded, multi-producer/multi-consumer queue...
+//
+// This is Dmitry Vyukov's sequence-numbered cell queue.  Every cell carries
+// a sequence number that tells a producer whether the cell is free for the
+// lap it's on and tells a consumer whether the cell's been filled for the
+// lap it's on.  Producers only contend with producers (on the enqueue
+// index) and consumers only contend with consumers (on the dequeue index),
+// each with a single CAS- there's no lock for anyone to park on.
+//
+// It's meant as a drop-in for TSQueue<T>: same constructor, same capacity
+// (exactly m_size entries- it isn't rounded), same blocking vs. drop-oldest
+// push() policy, and the same front()/pop() pair.  Be aware that front()
+// followed by pop() is two operations; with more than one consumer, two of
+// them can be handed the same front().  That's no different than TSQueue,
+// but here there's a better answer- use try_pop(), which claims and moves
+// out the entry in one shot.  In drop-oldest mode, front() claims its entry
+// the way TSSPSCQueue's does, so a producer burning it waits for the pop()
+// rather than overwriting it while you're still looking.
+//
+// As with TSSPSCQueue, waiting is a spin with a yield().
+template <typename T> class TSMPMCQueue {
+    public:
+        /**
+         * Constructor
+         */
+        TSMPMCQueue(size_t size = 512, bool blocking = true) :
+            m_blocking(blocking), m_size((size > 0) ? size : 1),
+            m_mask(((m_size & (m_size - 1)) == 0) ? (m_size - 1) : 0),
+            m_cells(new Cell[m_size]), m_enqueue(0), m_dequeue(0), m_claim(0), m_front(0)
+        {
+            for (size_t i = 0; i < m_size; i++)
+            {
+                m_cells[i].seq.store(i, std::memory_order_relaxed);
+            }
+        };
+
+        /**
+         * Adds an item to the end of the queue if there's room for it.
+         * This never waits.
+         *
+         * @param item The item to be added to the queue.
+         *
+         * @return true if the item was queued, false if the queue was full.
+         */
+        bool try_push(const T& item)
+        {
+            Cell *cell;
+            size_t pos = m_enqueue.load(std::memory_order_relaxed);
+
+            for (;;)
+            {
+                cell = &m_cells[index(pos)];
+                intptr_t dif = (intptr_t) cell->seq.load(std::memory_order_acquire) - (intptr_t) pos;
+                if (dif == 0)
+                {
+                    // Cell's free on this lap- try to claim it.
+                    if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (dif < 0)
+                {
+                    // Cell still holds last lap's entry.  We're full.
+                    return false;
+                }
+                else
+                {
+                    // Someone beat us to it.
+                    pos = m_enqueue.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->data = item;
+            cell->seq.store(pos + 1, std::memory_order_release);
+            return true;
+        };
+
+        /**
+         * Removes the item at the front of the queue and hands it back,
+         * if there is one.  This never waits, and is the safe way to
+         * consume with more than one consumer.
+         *
+         * @param item Where to put the item.
+         *
+         * @return true if an item was removed, false if the queue was empty.
+         */
+        bool try_pop(T& item)
+        {
+            return dequeue([&](T& data) { item = std::move(data); });
+        };
+
+        /**
+         * Value-returning flavor of try_pop(), matching TSQueue's.
+         *
+         * @return The item that was at the front of the queue, or nothing
+         *         if the queue was empty.
+         */
+        std::optional<T> try_pop()
+        {
+            std::optional<T> retVal;
+            dequeue([&](T& data) { retVal.emplace(std::move(data)); });
+            return retVal;
+        };
+
+        /**
+         * Adds an item to the end of the queue.
+         *
+         * If the queue is full, this either waits for a consumer to make
+         * room (blocking) or throws the oldest entry on the floor.
+         *
+         * @param item The item to be added to the queue.
+         */
+        void push(const T& item)
+        {
+            while (!try_push(item))
+            {
+                if (m_blocking)
+                {
+                    std::this_thread::yield();
+                }
+                else
+                {
+                    // Burn the front.  Throw it on the floor.  We're full and this isn't blocking.
+                    dequeue([](T&) {}, true);
+                }
+            }
+        };
+
+        /**
+         * Returns the item at the front of the queue, waiting for one if
+         * the queue is empty.
+         *
+         * @return The item at the front of the queue.
+         */
+        T& front()
+        {
+            for (;;)
+            {
+                size_t pos = m_dequeue.load(m_blocking ? std::memory_order_acquire : std::memory_order_seq_cst);
+                Cell &cell = m_cells[index(pos)];
+                if (cell.seq.load(std::memory_order_acquire) == (pos + 1))
+                {
+                    if (m_blocking)
+                    {
+                        return cell.data;
+                    }
+
+                    // Non-blocking mode- tell the producers we're looking at this cell, then make
+                    // sure it didn't get burned out from under us in the meantime.
+                    m_claim.store(pos + 1, std::memory_order_seq_cst);
+                    if (m_dequeue.load(std::memory_order_seq_cst) == pos)
+                    {
+                        m_front = pos;
+                        return cell.data;
+                    }
+                    m_claim.store(0, std::memory_order_seq_cst);
+                    continue;
+                }
+                std::this_thread::yield();
+            }
+        };
+
+        /**
+         * Removes the item at the front of the queue, if there is one.
+         */
+        void pop()
+        {
+            if (m_claim.load(std::memory_order_relaxed) == 0)
+            {
+                dequeue([](T&) {});
+                return;
+            }
+
+            // Take exactly the entry front() handed out.  If a producer already
+            // burned it, this fails and that entry is gone either way.
+            size_t pos = m_front;
+            if (m_dequeue.compare_exchange_strong(pos, pos + 1, std::memory_order_seq_cst))
+            {
+                Cell &cell = m_cells[index(pos)];
+                cell.data = T();
+                cell.seq.store(pos + m_size, std::memory_order_release);
+            }
+            m_claim.store(0, std::memory_order_seq_cst);
+        };
+
+        /**
+         * Checks if the queue is empty.  This is only a snapshot.
+         *
+         * @return True if the queue is empty, otherwise false.
+         */
+        bool empty()
+        {
+            return size() == 0;
+        }
+
+        /**
+         * Returns the current size of the queue.  This is only a snapshot.
+         *
+         * @return The current size of the queue.
+         */
+        size_t size()
+        {
+            size_t dequeue = m_dequeue.load(std::memory_order_acquire);
+            size_t enqueue = m_enqueue.load(std::memory_order_acquire);
+            return (enqueue > dequeue) ? (enqueue - dequeue) : 0;
+        }
+
+    private:
+        struct Cell
+        {
+            std::atomic<size_t> seq;
+            T data;
+        };
+
+        size_t index(size_t pos) const
+        {
+            return (m_mask != 0) ? (pos & m_mask) : (pos % m_size);
+        }
+
+        // Claims the front cell, if it's been filled, and hands the entry
+        // to take() before releasing the cell to the producers' next lap.
+        // The cell's reset on the way, so whatever the entry holds is let
+        // go of now rather than when the ring wraps around to it again.
+        // A producer burning an entry front() has claimed waits for the
+        // consumer to let go of it first.
+        template <typename F> bool dequeue(F take, bool burning = false)
+        {
+            Cell *cell;
+            size_t pos = m_dequeue.load(std::memory_order_relaxed);
+
+            for (;;)
+            {
+                cell = &m_cells[index(pos)];
+                intptr_t dif = (intptr_t) cell->seq.load(std::memory_order_acquire) - (intptr_t) (pos + 1);
+                if (dif == 0)
+                {
+                    if (m_dequeue.compare_exchange_weak(pos, pos + 1, m_blocking ? std::memory_order_relaxed : std::memory_order_seq_cst))
+                    {
+                        break;
+                    }
+                }
+                else if (dif < 0)
+                {
+                    // Not filled yet.  We're empty.
+                    return false;
+                }
+                else
+                {
+                    pos = m_dequeue.load(std::memory_order_relaxed);
+                }
+            }
+
+            if (burning)
+            {
+                while (m_claim.load(std::memory_order_seq_cst) == (pos + 1))
+                {
+                    std::this_thread::yield();
+                }
+            }
+
+            take(cell->data);
+            cell->data = T();
+            cell->seq.store(pos + m_size, std::memory_order_release);
+            return true;
+        };
+
+        // Read-only after construction...
+        const bool m_blocking;
+        const size_t m_size;
+        const size_t m_mask;                    // Non-zero only when m_size is a power of two
+        std::unique_ptr<Cell[]> m_cells;
+
+        // Producers' and consumers' indices each get their own line...
+        alignas(CACHELINE_SIZE) std::atomic<size_t> m_enqueue;
+        alignas(CACHELINE_SIZE) std::atomic<size_t> m_dequeue;
+        std::atomic<size_t> m_claim;            // Position+1 the consumer holds a front() reference on (non-blocking only)
+        size_t m_front;
+};
@@ -0,0 +1,350 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <CacheLine.hpp>
+#include <TSSleepers.hpp>
+
+// Implement a scalable, relaxed, concurrent priority queue...
+//
+// This is a MultiQueue (Rihani, Sanders & Dementiev).  Instead of one heap
+// behind one lock, there are several heaps, each behind its own lock.  A push
+// goes to a random heap.  A pop looks at the tops of two random heaps and
+// takes the better one.  Nobody serializes on a single heap root any more.
+//
+// The price is that the order is relaxed: pop() returns *an* entry near the
+// top, not necessarily THE top.  In practice it's within a few ranks of it,
+// and the error doesn't grow with the size of the queue.  If you need the
+// real thing, construct with relaxed = false- pops then lock every heap and
+// take the global best, which is correct but serializes like TSPriorityQueue
+// (and worse, since there's more than one lock to take).
+//
+// The push/front/pop API matches TSPriorityQueue's, with one difference:
+// front() hands back a copy, not a reference.  The heap an entry came from
+// is unlocked between front() and pop(), and any push to it can move the
+// entry or outrank it, so there's nothing stable to refer to.  front() marks
+// the entry it copied, and the pop() after it removes that same entry
+// wherever it's got to, or nothing if another consumer took it first.
+// try_pop() and pop_wait() look and take under the one lock, so with more
+// than one consumer they're the better choice.
+//
+// LockPolicy picks the heaps' (and the sleepers') lock, as with TSQueue.
+// It's got to have try_lock(); all of LockPolicy.hpp's do.
+template <typename T, typename Compare = std::less<T>, typename LockPolicy = std::mutex> class TSMultiQueue {
+    public:
+        /**
+         * Constructor
+         *
+         * @param relaxed Whether pops may return a near-top entry (true) or must
+         *                return the global top (false).
+         * @param heaps Number of internal heaps- defaults to two per hardware thread.
+         */
+        TSMultiQueue(bool relaxed = true, size_t heaps = 0) :
+            m_relaxed(relaxed),
+            m_heapCount((heaps > 0) ? heaps : (2 * ((std::thread::hardware_concurrency() > 0) ? std::thread::hardware_concurrency() : 4))),
+            m_heaps(new Heap[m_heapCount]), m_serial(nextSerial()) {};
+
+        /// Pushes an item onto a random heap, and notifies one waiting thread.
+        void push(const T& item)
+        {
+            Heap *heap = NULL;
+            std::unique_lock<LockPolicy> lock;
+
+            // Pick a heap nobody's using right now, if we can find one quickly.
+            for (size_t tries = 0; tries < m_heapCount; tries++)
+            {
+                heap = &m_heaps[random() % m_heapCount];
+                lock = std::unique_lock<LockPolicy>(heap->lock, std::try_to_lock);
+                if (lock.owns_lock())
+                {
+                    break;
+                }
+            }
+            if (!lock.owns_lock())
+            {
+                lock = std::unique_lock<LockPolicy>(heap->lock);
+            }
+
+            heap->entries.push_back(Entry{ item, heap->nextId++ });
+            std::push_heap(heap->entries.begin(), heap->entries.end(), ByItem{ m_compare });
+            heap->size.store(heap->entries.size(), std::memory_order_release);
+            lock.unlock();
+
+            m_sleepers.wake_one();
+        };
+
+        /// Removes and hands back an entry at (or, relaxed, near) the top of
+        /// the queue, if there is one.  Never waits.
+        std::optional<T> try_pop()
+        {
+            std::optional<T> retVal;
+            take([&](Heap& heap)
+            {
+                std::pop_heap(heap.entries.begin(), heap.entries.end(), ByItem{ m_compare });
+                retVal.emplace(std::move(heap.entries.back().item));
+                heap.entries.pop_back();
+            });
+            return retVal;
+        };
+
+        /// Like try_pop(), but waits as long as it takes for an entry.
+        T pop_wait()
+        {
+            std::optional<T> retVal;
+            waitFor([&]{ return (retVal = try_pop()).has_value(); });
+            return std::move(*retVal);
+        };
+
+        /// Provides a copy of the entry at (or, relaxed, near) the front of
+        /// the queue, waiting for one if the queue is empty.
+        T front()
+        {
+            std::optional<T> retVal;
+            waitFor([&]
+            {
+                return take([&](Heap& heap)
+                {
+                    retVal.emplace(heap.entries.front().item);
+                    remember(&heap, heap.entries.front().id);
+                });
+            });
+            return std::move(*retVal);
+        };
+
+        /// Removes the entry the last front() on this thread showed, if
+        /// nobody else has taken it since.  Without a front() first, removes
+        /// whatever try_pop() would have.
+        void pop()
+        {
+            Heap *heap = NULL;
+            uint64_t id = 0;
+            if (!forget(heap, id))
+            {
+                try_pop();
+                return;
+            }
+
+            std::lock_guard<LockPolicy> lock(heap->lock);
+            std::vector<Entry> &entries = heap->entries;
+            if (!entries.empty() && (entries.front().id == id))
+            {
+                std::pop_heap(entries.begin(), entries.end(), ByItem{ m_compare });
+                entries.pop_back();
+            }
+            else
+            {
+                // Something outranked it since.  Take it out of the middle
+                // and rebuild- O(n), but only when front() got overtaken.
+                auto found = std::find_if(entries.begin(), entries.end(), [&](const Entry& entry) { return entry.id == id; });
+                if (found == entries.end())
+                {
+                    return;
+                }
+                *found = std::move(entries.back());
+                entries.pop_back();
+                std::make_heap(entries.begin(), entries.end(), ByItem{ m_compare });
+            }
+            heap->size.store(entries.size(), std::memory_order_release);
+        };
+
+        /// Check if the queue is empty.  This is only a snapshot.
+        bool empty()
+        {
+            return size() == 0;
+        }
+
+        /// Returns the number of elements in the queue.  This is only a snapshot.
+        size_t size()
+        {
+            size_t retVal = 0;
+            for (size_t i = 0; i < m_heapCount; i++)
+            {
+                retVal += m_heaps[i].size.load(std::memory_order_acquire);
+            }
+            return retVal;
+        }
+
+    private:
+        struct Entry
+        {
+            T item;
+            uint64_t id;
+        };
+
+        struct ByItem
+        {
+            Compare &compare;
+
+            bool operator()(const Entry& a, const Entry& b) const { return compare(a.item, b.item); };
+        };
+
+        struct alignas(CACHELINE_SIZE) Heap
+        {
+            LockPolicy lock;
+            std::atomic<size_t> size = 0;       // So we can skip empty heaps without locking them
+            std::vector<Entry> entries;         // A binary heap, by item
+            uint64_t nextId = 0;                // Stamped on each entry, for pop() to find it by
+        };
+
+        // What this thread's last front() on a queue showed it.  Queues are
+        // told apart by serial rather than address, so one that's gone can't
+        // be mistaken for a new one in the same spot.
+        struct Shown
+        {
+            uint64_t queue;
+            Heap *heap;
+            uint64_t id;
+        };
+
+        static uint64_t nextSerial()
+        {
+            static std::atomic<uint64_t> serial(0);
+            return serial.fetch_add(1, std::memory_order_relaxed);
+        };
+
+        static std::vector<Shown>& shown()
+        {
+            static thread_local std::vector<Shown> retVal;
+            return retVal;
+        };
+
+        void remember(Heap *heap, uint64_t id)
+        {
+            for (Shown &entry : shown())
+            {
+                if (entry.queue == m_serial)
+                {
+                    entry.heap = heap;
+                    entry.id = id;
+                    return;
+                }
+            }
+            shown().push_back(Shown{ m_serial, heap, id });
+        };
+
+        bool forget(Heap *&heap, uint64_t &id)
+        {
+            std::vector<Shown> &list = shown();
+            for (size_t i = 0; i < list.size(); i++)
+            {
+                if (list[i].queue == m_serial)
+                {
+                    heap = list[i].heap;
+                    id = list[i].id;
+                    list[i] = list.back();
+                    list.pop_back();
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        // Per-thread xorshift- cheap, and no shared state to fight over.
+        static size_t random()
+        {
+            static thread_local size_t state = std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        };
+
+        // Finds the heap to take from- best of two random ones when relaxed,
+        // the global best otherwise- and runs use() on it with its lock held.
+        // Returns false if the queue was empty.
+        template <typename F> bool take(F use)
+        {
+            if (m_relaxed)
+            {
+                for (size_t tries = 0; tries < m_heapCount; tries++)
+                {
+                    Heap &a = m_heaps[random() % m_heapCount];
+                    Heap &b = m_heaps[random() % m_heapCount];
+                    if ((a.size.load(std::memory_order_acquire) == 0) && (b.size.load(std::memory_order_acquire) == 0))
+                    {
+                        continue;
+                    }
+
+                    std::unique_lock<LockPolicy> lockA(a.lock, std::try_to_lock);
+                    if (!lockA.owns_lock())
+                    {
+                        continue;
+                    }
+                    std::unique_lock<LockPolicy> lockB;
+                    if (&a != &b)
+                    {
+                        lockB = std::unique_lock<LockPolicy>(b.lock, std::try_to_lock);
+                        if (!lockB.owns_lock())
+                        {
+                            continue;
+                        }
+                    }
+
+                    Heap *best = better(&a, &b);
+                    if (best != NULL)
+                    {
+                        use(*best);
+                        best->size.store(best->entries.size(), std::memory_order_release);
+                        return true;
+                    }
+                }
+                // Couldn't find anything by sampling.  Fall through to the
+                // exhaustive look so "empty" really means empty.
+            }
+
+            std::vector<std::unique_lock<LockPolicy>> locks;
+            locks.reserve(m_heapCount);
+            Heap *best = NULL;
+            for (size_t i = 0; i < m_heapCount; i++)
+            {
+                locks.emplace_back(m_heaps[i].lock);
+                best = better(best, &m_heaps[i]);
+            }
+            if (best == NULL)
+            {
+                return false;
+            }
+            use(*best);
+            best->size.store(best->entries.size(), std::memory_order_release);
+            return true;
+        };
+
+        // Of two (locked, possibly NULL) heaps, the one with the better top,
+        // or NULL if neither has anything.
+        Heap* better(Heap *a, Heap *b)
+        {
+            if ((a == NULL) || a->entries.empty())
+            {
+                return ((b != NULL) && !b->entries.empty()) ? b : NULL;
+            }
+            if ((b == NULL) || b->entries.empty())
+            {
+                return a;
+            }
+            return m_compare(a->entries.front().item, b->entries.front().item) ? b : a;
+        };
+
+        // Runs attempt() until it succeeds, sleeping in between.
+        template <typename F> void waitFor(F attempt)
+        {
+            m_sleepers.wait(attempt, []{ return false; });
+        };
+
+        // Read-only after construction...
+        const bool m_relaxed;
+        const size_t m_heapCount;
+        std::unique_ptr<Heap[]> m_heaps;
+        Compare m_compare;
+        const uint64_t m_serial;                // For telling this queue's front()s from another's
+
+        // Consumer sleep/wakeup...
+        TSSleepers<LockPolicy> m_sleepers;
+};
@@ -1,28 +1,158 @@
 #include <thread>
-#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <functional>
+#include <type_traits>
+
+#include <AgingHeap.hpp>
+#include <BucketQueue.hpp>
+#include <DaryHeap.hpp>
+#include <LockCondition.hpp>
+#include <LockProfile.hpp>
 
 #pragma once
 
 // Implement a fairly proper threadsafe queue...
-template <typename T> class TSPriorityQueue {
+//
+// The entries live in a 4-ary DaryHeap ordered by Compare (std::less, so the
+// largest comes out first, same as std::priority_queue).  push() hands back a
+// Handle; while that entry is still queued, update() changes its priority and
+// erase() pulls it out, so there's no need to push duplicates and weed out the
+// stale ones on the way out.
+//
+// If there are only a few distinct priorities, pass PriorityLevels<N, Level>
+// as the Compare and the heap is swapped for a BucketQueue: O(1) push and pop,
+// and FIFO order among entries at the same level.
+//
+// If low priority entries mustn't starve, pass AgingLevels<N, AgeMs, Level>
+// instead and an entry gains a level for every AgeMs it waits (see
+// AgingHeap.hpp for why that's no dearer than the plain heap).  wait_stats()
+// then reports how long entries at each level actually waited.
+//
+// Give it a Capacity and the heap lives inside the queue object, so nothing
+// hits the allocator after construction.  A full queue then either waits for
+// room (blocking) or throws its lowest priority entry on the floor- which may
+// be the one being pushed.  Without a Capacity, the queue is unbounded and
+// blocking doesn't matter.
+//
+// LockPolicy is the queue's lock: std::mutex unless you pick another from
+// LockPolicy.hpp, same as TSQueue.  With
+// RPE_LOCK_PROFILE defined, the lock shows up in the LockProfile as
+// TSPriorityQueue, or whatever profile_as() calls it.
+
+// Picks the storage for a TSPriorityQueue- a heap for a comparator, buckets
+// for a PriorityLevels.
+template <typename T, size_t Capacity, typename Compare> struct TSPriorityStorage
+{
+    using type = DaryHeap<T, Compare, Capacity>;
+};
+
+template <typename T, size_t Capacity, size_t Levels, typename Level> struct TSPriorityStorage<T, Capacity, PriorityLevels<Levels, Level>>
+{
+    using type = BucketQueue<T, Levels, Level, Capacity>;
+};
+
+template <typename T, size_t Capacity, size_t Levels, size_t AgeMs, typename Level> struct TSPriorityStorage<T, Capacity, AgingLevels<Levels, AgeMs, Level>>
+{
+    using type = AgingHeap<T, Levels, AgeMs, Level, Capacity>;
+};
+
+template <typename T, size_t Capacity = 0, typename Compare = std::less<T>, typename LockPolicy = std::mutex> class TSPriorityQueue {
     public:
+        /// Refers to a queued entry, for update() and erase().
+        using Handle = typename TSPriorityStorage<T, Capacity, Compare>::type::Handle;
+
+        /// Constructor
+        TSPriorityQueue(bool blocking = true) : m_blocking(blocking)
+        {
+            LOCKPROFILE_NAME(mutex, "TSPriorityQueue");
+        };
+
         /// Pushes an item onto the queue, and notifies one waiting thread.
-        void push(const T& item)
+        /// Returns the entry's handle- not valid() if a full, non-blocking
+        /// queue threw the item on the floor.
+        Handle push(const T& item)
         {
+            Handle retVal;
+
             {
-                std::lock_guard lock(mutex);
-                queue.push(item);
+                std::unique_lock lock(mutex);
+                retVal = insert(lock, item);
             }
 
             cond_var.notify_one();
+            return retVal;
+        };
+
+        /**
+         * Replaces a queued entry's value, moving it up or down the queue
+         * to match its new priority.
+         * This method is thread-safe.
+         *
+         * @param handle The entry, as returned by push().
+         * @param item The new value.
+         *
+         * @return true if it was updated, false if the entry has already
+         *         been popped or erased.
+         */
+        bool update(const Handle& handle, const T& item)
+        {
+            std::lock_guard lock(mutex);
+            return queue.update(handle, item);
+        };
+
+        /**
+         * Removes a queued entry, wherever it is in the queue.
+         * This method is thread-safe.
+         *
+         * @param handle The entry, as returned by push().
+         *
+         * @return true if it was removed, false if the entry has already
+         *         been popped or erased.
+         */
+        bool erase(const Handle& handle)
+        {
+            bool retVal;
+
+            {
+                std::lock_guard lock(mutex);
+                retVal = queue.erase(handle);
+            }
+
+            if ((Capacity > 0) && retVal)
+            {
+                cond_var.notify_one();
+            }
+            return retVal;
+        };
+
+        /// Pushes a range of items onto the queue under a single lock, and
+        /// notifies the waiting threads once for the whole batch.
+        template <typename InputIt> void push_bulk(InputIt first, InputIt last)
+        {
+            {
+                std::unique_lock lock(mutex);
+                for (; first != last; ++first)
+                {
+                    if (full() && m_blocking)
+                    {
+                        // Let the consumers at what we have before we wait.
+                        cond_var.notify_all();
+                    }
+                    insert(lock, *first);
+                }
+            }
+
+            cond_var.notify_all();
         };
 
         /// Provides the entry from the front of the queue
-        T& front()
+        const T& front()
         {
             std::unique_lock lock(mutex);
             cond_var.wait(lock, [&]{ return !queue.empty(); });
-            return queue.front();
+            return queue.top();
         };
 
         /// Removes the front entry from the queue, so that the next front
@@ -31,6 +161,85 @@ template <typename T> class TSPriorityQueue {
         {
             std::lock_guard lock(mutex);
             queue.pop();
+            if (Capacity > 0)
+            {
+                cond_var.notify_one();
+            }
+        };
+
+        /// Removes and hands back the front entry, if there is one, under a
+        /// single lock.  Never waits.
+        std::optional<T> try_pop()
+        {
+            std::optional<T> retVal;
+
+            {
+                std::lock_guard lock(mutex);
+                if (queue.empty())
+                {
+                    return retVal;
+                }
+                retVal.emplace(queue.take());
+            }
+
+            if (Capacity > 0)
+            {
+                cond_var.notify_one();
+            }
+            return retVal;
+        };
+
+        /// Removes up to max entries, highest priority first, under a single
+        /// lock.  Waits for at least one if the queue is empty.  Returns the
+        /// number of entries removed.
+        template <typename OutputIt> size_t pop_bulk(OutputIt out, size_t max)
+        {
+            size_t count = 0;
+
+            if (max > 0)
+            {
+                std::unique_lock lock(mutex);
+                cond_var.wait(lock, [&]{ return !queue.empty(); });
+                for (; (count < max) && !queue.empty(); count++)
+                {
+                    *out++ = queue.take();
+                }
+            }
+
+            if (Capacity > 0)
+            {
+                cond_var.notify_all();
+            }
+            return count;
+        };
+
+        /// Moves everything currently in the queue, highest priority first,
+        /// onto the end of a container under a single lock.  Never waits.
+        /// Returns the number of entries moved.
+        template <typename Container> size_t drain_into(Container& container)
+        {
+            size_t count = 0;
+
+            {
+                std::lock_guard lock(mutex);
+                for (; !queue.empty(); count++)
+                {
+                    container.insert(container.end(), queue.take());
+                }
+            }
+
+            if ((Capacity > 0) && (count > 0))
+            {
+                cond_var.notify_all();
+            }
+            return count;
+        };
+
+        /// Names the queue's lock in the lock profile.  Does nothing unless
+        /// RPE_LOCK_PROFILE is defined.
+        void profile_as(const char *name)
+        {
+            LOCKPROFILE_NAME(mutex, name);
         };
 
         /// Check if the queue is empty.
@@ -46,8 +255,52 @@ template <typename T> class TSPriorityQueue {
             return queue.size();
         }
 
+        /// How long entries at a priority level waited, for an AgingLevels
+        /// queue.
+        TSPriorityWaitStats wait_stats(size_t level)
+        {
+            std::lock_guard lock(mutex);
+            return queue.wait_stats(level);
+        };
+
+        /// Starts the wait statistics over, for an AgingLevels queue.
+        void reset_wait_stats()
+        {
+            std::lock_guard lock(mutex);
+            queue.reset_wait_stats();
+        };
+
     private:
-        std::mutex mutex;
-        std::condition_variable cond_var;
-        std::priority_queue<T> queue;
-};
\ No newline at end of file
+        bool full()
+        {
+            return (Capacity > 0) && (queue.size() >= Capacity);
+        };
+
+        // Called with the lock held.  Enforces the overflow policy and
+        // pushes item, returning its handle.
+        Handle insert(std::unique_lock<ProfiledLock<LockPolicy>>& lock, const T& item)
+        {
+            if constexpr (Capacity > 0)
+            {
+                if (full())
+                {
+                    if (m_blocking)
+                    {
+                        // Wait until there is room
+                        cond_var.wait(lock, [&]{ return !full(); });
+                    }
+                    else
+                    {
+                        // Shed the least important entry.  Throw it on the floor.
+                        return queue.replace_lowest(item);
+                    }
+                }
+            }
+            return queue.push(item);
+        };
+
+        bool m_blocking;
+        ProfiledLock<LockPolicy> mutex;
+        typename LockCondition<ProfiledLock<LockPolicy>>::type cond_var;
+        typename TSPriorityStorage<T, Capacity, Compare>::type queue;
+};
@@ -1,16 +1,80 @@
 #pragma once
 
 #include <thread>
+#include <mutex>
 #include <condition_variable>
-#include <queue>
+#include <chrono>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+#include <ChunkedQueue.hpp>
+#include <FixedStorage.hpp>
+#include <LockCondition.hpp>
+#include <LockProfile.hpp>
+#include <TSSelect.hpp>
 
 // Implement a fairly proper threadsafe queue...
-template <typename T> class TSQueue {
+//
+// Give it a Capacity and the entries live in a ring inside the queue object
+// instead of a std::queue, so nothing hits the heap after construction.  The
+// size passed to the constructor is then clamped to Capacity.  Without one,
+// entries live in a ChunkedQueue, which recycles its segments instead of
+// going back to the allocator on every burst- see trim().
+//
+// TSQueues can be waited on together with TSSelect, or, on Linux, alongside
+// file descriptors in a poll() loop via getEventFD().
+//
+// LockPolicy is the queue's lock: std::mutex unless you pick another from
+// LockPolicy.hpp- NullMtx for single-threaded builds, AtomicMtx for very
+// short critical sections, FutexMtx, or PI_MUTEX when real-time threads
+// share the queue.  Waits go through the LockCondition for it: a
+// std::condition_variable_any unless the lock has a partner of its own
+// (PI_MUTEX waits on a PI_CONDITION).  With
+// RPE_LOCK_PROFILE defined, the lock shows up in the LockProfile as TSQueue,
+// or whatever profile_as() calls it.
+//
+// For shutdown, close() wakes everyone blocked on the queue.  Producers get
+// turned away from then on; consumers can keep draining what's left, and
+// once it's empty, they get told it's closed instead of waiting.
+
+/// Thrown by TSQueue::front() when the queue is closed and empty- there's
+/// nothing to hand back a reference to.
+class TSQueueClosed : public std::runtime_error
+{
+    public:
+        TSQueueClosed() : std::runtime_error("TSQueue is closed") {};
+};
+
+template <typename T, size_t Capacity = 0, typename LockPolicy = std::mutex> class TSQueue : public TSSelectable {
     public:
         /**
          * Constructor
          */
-        TSQueue(size_t size = 512, bool blocking = true) : m_blocking(blocking), m_size(size) {};
+        TSQueue(size_t size = ((Capacity > 0) ? Capacity : 512), bool blocking = true) :
+            m_blocking(blocking), m_size(((Capacity > 0) && (size > Capacity)) ? Capacity : size),
+            m_closed(false), m_eventFD(-1), m_eventSet(false)
+        {
+            LOCKPROFILE_NAME(mutex, "TSQueue");
+        };
+
+        /**
+         * Destructor
+         */
+        ~TSQueue()
+        {
+#if defined(__linux__)
+            if (m_eventFD >= 0)
+            {
+                ::close(m_eventFD);
+            }
+#endif
+        };
 
         /**
          * Adds an item to the end of the queue.
@@ -18,30 +82,77 @@ template <typename T> class TSQueue {
          * that an item has been added.
          *
          * @param item The item to be added to the queue.
+         *
+         * @return true if the item was added, false if the queue is closed.
          */
-        void push(const T& item)
+        bool push(const T& item)
         {
-            {
-                std::lock_guard lock(mutex);
+            return emplace(item);
+        };
 
-                if (queue.size() >= m_size)
+        /**
+         * Moves an item onto the end of the queue.
+         * This method is thread-safe and will notify one waiting thread
+         * that an item has been added.
+         *
+         * @param item The item to be moved into the queue.
+         *
+         * @return true if the item was added, false if the queue is closed.
+         */
+        bool push(T&& item)
+        {
+            return emplace(std::move(item));
+        };
+
+        /**
+         * Constructs an item in place at the end of the queue.
+         * This method is thread-safe and will notify one waiting thread
+         * that an item has been added.
+         *
+         * @param args The arguments to construct the item with.
+         *
+         * @return true if the item was added, false if the queue is closed.
+         */
+        template <typename... Args> bool emplace(Args&&... args)
+        {
+            {
+                std::unique_lock lock(mutex);
+                if (!makeRoom(lock))
                 {
-                    if (m_blocking)
-                    {
-                        // Wait until there is room
-                        std::unique_lock wait_lock(mutex);
-                        cond_var.wait(wait_lock, [&]{ return queue.size() < m_size; });
-                    }
-                    else
-                    {
-                        // Burn the front.  Throw it on the floor.  We're full and this isn't blocking.
-                        queue.pop();
-                    }
+                    return false;
                 }
-                queue.push(item);
+                queue.emplace(std::forward<Args>(args)...);
+                setEventFD();
             }
 
             cond_var.notify_one();
+            notifySelectors();
+            return true;
+        };
+
+        /**
+         * Adds an item to the end of the queue, waiting at most timeout
+         * for room if the queue is full and blocking.  A non-blocking
+         * queue never waits- it drops the oldest entry, as push() does.
+         * This method is thread-safe.
+         *
+         * @param item The item to be added to the queue.
+         * @param timeout The longest to wait for room.
+         *
+         * @return true if the item was added, false if we timed out or
+         *         the queue is closed.
+         */
+        template <typename Rep, typename Period>
+            bool push_for(const T& item, const std::chrono::duration<Rep, Period>& timeout)
+        {
+            return pushUntil(item, std::chrono::steady_clock::now() + timeout);
+        };
+
+        /// Moving flavor of push_for().  If we time out, item is left untouched.
+        template <typename Rep, typename Period>
+            bool push_for(T&& item, const std::chrono::duration<Rep, Period>& timeout)
+        {
+            return pushUntil(std::move(item), std::chrono::steady_clock::now() + timeout);
         };
 
         /**
@@ -49,11 +160,17 @@ template <typename T> class TSQueue {
          * This method is thread-safe.
          *
          * @return The item at the front of the queue.
+         *
+         * @exception TSQueueClosed Thrown if the queue is closed and empty.
          */
         T& front()
         {
             std::unique_lock lock(mutex);
-            cond_var.wait(lock, [&]{ return !queue.empty(); });
+            cond_var.wait(lock, [&]{ return !queue.empty() || m_closed; });
+            if (queue.empty())
+            {
+                throw TSQueueClosed();
+            }
             return queue.front();
         };
 
@@ -64,10 +181,319 @@ template <typename T> class TSQueue {
         void pop()
         {
             std::lock_guard lock(mutex);
-            queue.pop();
+            if (!queue.empty())
+            {
+                queue.pop();
+                clearEventFD();
+            }
+            cond_var.notify_one();
+        };
+
+        /**
+         * Removes the item at the front of the queue and hands it back,
+         * moved out under one lock, if there is one.  This never waits.
+         * This method is thread-safe.
+         *
+         * @return The item that was at the front of the queue, or nothing
+         *         if the queue was empty.
+         */
+        std::optional<T> try_pop()
+        {
+            std::optional<T> retVal;
+
+            {
+                std::lock_guard lock(mutex);
+                if (queue.empty())
+                {
+                    return retVal;
+                }
+                retVal.emplace(std::move(queue.front()));
+                queue.pop();
+                clearEventFD();
+            }
+
             cond_var.notify_one();
+            return retVal;
+        };
+
+        /**
+         * Removes the item at the front of the queue and hands it back,
+         * moved out under one lock, waiting at most timeout for one if the
+         * queue is empty.
+         * This method is thread-safe.
+         *
+         * @param timeout The longest to wait for an item.
+         *
+         * @return The item that was at the front of the queue, or nothing
+         *         if we timed out or the queue is closed and empty.
+         */
+        template <typename Rep, typename Period>
+            std::optional<T> pop_for(const std::chrono::duration<Rep, Period>& timeout)
+        {
+            std::optional<T> retVal;
+
+            {
+                std::unique_lock lock(mutex);
+                cond_var.wait_for(lock, timeout, [&]{ return !queue.empty() || m_closed; });
+                if (queue.empty())
+                {
+                    return retVal;
+                }
+                retVal.emplace(std::move(queue.front()));
+                queue.pop();
+                clearEventFD();
+            }
+
+            cond_var.notify_one();
+            return retVal;
+        };
+
+        /**
+         * Removes the item at the front of the queue and hands it back,
+         * moved out under one lock, waiting as long as it takes for one.
+         * This is the consumer loop's answer to close():
+         *
+         *     while (auto item = queue.pop_wait()) { ... }
+         *
+         * This method is thread-safe.
+         *
+         * @return The item that was at the front of the queue, or nothing
+         *         if the queue is closed and empty.
+         */
+        std::optional<T> pop_wait()
+        {
+            std::optional<T> retVal;
+
+            {
+                std::unique_lock lock(mutex);
+                cond_var.wait(lock, [&]{ return !queue.empty() || m_closed; });
+                if (queue.empty())
+                {
+                    return retVal;
+                }
+                retVal.emplace(std::move(queue.front()));
+                queue.pop();
+                clearEventFD();
+            }
+
+            cond_var.notify_one();
+            return retVal;
+        };
+
+        /**
+         * Adds a range of items to the end of the queue under a single
+         * lock, waking the waiting threads once for the whole batch.
+         * This method is thread-safe.
+         *
+         * Overflow follows the same rules as push().  In blocking mode, if
+         * the batch doesn't fit, what's been added so far is handed to the
+         * consumers while we wait for room for the rest.
+         *
+         * @param first The start of the range to be added to the queue.
+         * @param last The end of the range to be added to the queue.
+         *
+         * @return The number of items added.  Short of the whole range only
+         *         if the queue is (or got) closed.
+         */
+        template <typename InputIt> size_t push_bulk(InputIt first, InputIt last)
+        {
+            size_t count = 0;
+
+            {
+                std::unique_lock lock(mutex);
+
+                for (; (first != last) && !m_closed; ++first, count++)
+                {
+                    if ((queue.size() >= m_size) && m_blocking)
+                    {
+                        // Let the consumers at what we have before we wait for room.
+                        cond_var.notify_all();
+                    }
+                    if (!makeRoom(lock))
+                    {
+                        break;
+                    }
+                    queue.push(*first);
+                }
+                setEventFD();
+            }
+
+            cond_var.notify_all();
+            notifySelectors();
+            return count;
         };
 
+        /**
+         * Removes up to max items from the front of the queue under a
+         * single lock, waiting for at least one if the queue is empty.
+         * This method is thread-safe.
+         *
+         * @param out Where to put the items, in queue order.
+         * @param max The most items to remove.
+         *
+         * @return The number of items removed.  Zero only if the queue is
+         *         closed and empty (or max was zero).
+         */
+        template <typename OutputIt> size_t pop_bulk(OutputIt out, size_t max)
+        {
+            size_t count = 0;
+
+            if (max > 0)
+            {
+                std::unique_lock lock(mutex);
+                cond_var.wait(lock, [&]{ return !queue.empty() || m_closed; });
+                for (; (count < max) && !queue.empty(); count++)
+                {
+                    *out++ = std::move(queue.front());
+                    queue.pop();
+                }
+                clearEventFD();
+            }
+
+            cond_var.notify_all();
+            return count;
+        };
+
+        /**
+         * Moves everything currently in the queue onto the end of a
+         * container under a single lock.  This never waits.
+         * This method is thread-safe.
+         *
+         * @param container The container to put the items in, in queue order.
+         *
+         * @return The number of items moved.
+         */
+        template <typename Container> size_t drain_into(Container& container)
+        {
+            size_t count = 0;
+
+            {
+                std::lock_guard lock(mutex);
+                for (; !queue.empty(); count++)
+                {
+                    container.insert(container.end(), std::move(queue.front()));
+                    queue.pop();
+                }
+                clearEventFD();
+            }
+
+            if (count > 0)
+            {
+                cond_var.notify_all();
+            }
+            return count;
+        };
+
+        /**
+         * Closes the queue.  Every thread blocked on it- producers waiting
+         * for room, consumers waiting for entries, TSSelect and poll() on
+         * getEventFD()- is woken.  From then on, pushes are refused, and
+         * consumers get what's left followed by a closed status: an empty
+         * optional, a zero count, or TSQueueClosed from front().
+         * This method is thread-safe.
+         */
+        void close()
+        {
+            {
+                std::lock_guard lock(mutex);
+                m_closed = true;
+                setEventFD();
+            }
+
+            cond_var.notify_all();
+            notifySelectors();
+        }
+
+        /**
+         * Re-opens a closed queue for business, keeping whatever is still
+         * in it, so a restart doesn't have to rebuild the plumbing.
+         * This method is thread-safe.
+         */
+        void reopen()
+        {
+            std::lock_guard lock(mutex);
+            m_closed = false;
+            clearEventFD();
+        }
+
+        /**
+         * Checks if the queue has been closed.
+         * This method is thread-safe.
+         *
+         * @return True if the queue is closed, otherwise false.
+         */
+        bool closed()
+        {
+            std::lock_guard lock(mutex);
+            return m_closed;
+        }
+
+        /**
+         * Checks if the queue has an entry in it (or is closed, which a
+         * consumer needs to hear about just the same), for TSSelect.
+         * This method is thread-safe.
+         *
+         * @return True if the queue has an entry in it or is closed,
+         *         otherwise false.
+         */
+        bool ready() override
+        {
+            std::lock_guard lock(mutex);
+            return !queue.empty() || m_closed;
+        }
+
+        /**
+         * Returns a file descriptor that polls readable whenever the queue
+         * has an entry in it or is closed, so the queue can sit in the same poll()/epoll
+         * loop as hardware fds.  The descriptor is created on the first call
+         * and belongs to the queue- don't read or close it yourself.  Once
+         * poll() says it's readable, take entries with try_pop().
+         * This method is thread-safe.  Linux only; elsewhere returns -1.
+         *
+         * @return The file descriptor, or -1 if one couldn't be made.
+         */
+        int getEventFD()
+        {
+#if defined(__linux__)
+            std::lock_guard lock(mutex);
+            if (m_eventFD < 0)
+            {
+                m_eventFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                setEventFD();
+            }
+#endif
+            return m_eventFD;
+        }
+
+        /**
+         * Gives spare storage segments left over from a burst back to the
+         * allocator, keeping at most keep of them for the next one.  A queue
+         * with a compile-time Capacity has nothing to give back.
+         * This method is thread-safe.
+         *
+         * @param keep The number of spare segments to hang on to.
+         */
+        void trim(size_t keep = 0)
+        {
+            if constexpr (Capacity == 0)
+            {
+                std::lock_guard lock(mutex);
+                queue.trim(keep);
+            }
+        }
+
+        /**
+         * Names the queue's lock in the lock profile, so it isn't lumped in
+         * with every other TSQueue.  Does nothing unless RPE_LOCK_PROFILE
+         * is defined.
+         *
+         * @param name The name to count the lock under.
+         */
+        void profile_as(const char *name)
+        {
+            LOCKPROFILE_NAME(mutex, name);
+        }
+
         /**
          * Checks if the queue is empty.
          * This method is thread-safe.
@@ -91,9 +517,83 @@ template <typename T> class TSQueue {
         }
 
     private:
+        // Called with the lock held.  Enforces the overflow policy so there's
+        // room for one more entry when we return true.  Returns false if the
+        // queue is (or gets, while we wait) closed.
+        bool makeRoom(std::unique_lock<ProfiledLock<LockPolicy>>& lock)
+        {
+            if (queue.size() >= m_size)
+            {
+                if (m_blocking)
+                {
+                    // Wait until there is room
+                    cond_var.wait(lock, [&]{ return (queue.size() < m_size) || m_closed; });
+                }
+                else
+                {
+                    // Burn the front.  Throw it on the floor.  We're full and this isn't blocking.
+                    queue.pop();
+                }
+            }
+            return !m_closed;
+        };
+
+        template <typename U>
+            bool pushUntil(U&& item, const std::chrono::steady_clock::time_point& deadline)
+        {
+            {
+                std::unique_lock lock(mutex);
+                if (m_blocking)
+                {
+                    if (!cond_var.wait_until(lock, deadline, [&]{ return (queue.size() < m_size) || m_closed; }) || m_closed)
+                    {
+                        return false;
+                    }
+                }
+                else if (!makeRoom(lock))
+                {
+                    return false;
+                }
+                queue.push(std::forward<U>(item));
+                setEventFD();
+            }
+
+            cond_var.notify_one();
+            notifySelectors();
+            return true;
+        };
+
+        // Called with the lock held after entries are added/removed.  These
+        // only touch the eventfd when the queue flips between empty and not
+        // (or gets closed).
+        void setEventFD()
+        {
+#if defined(__linux__)
+            if ((m_eventFD >= 0) && !m_eventSet && (!queue.empty() || m_closed))
+            {
+                uint64_t one = 1;
+                m_eventSet = (::write(m_eventFD, &one, sizeof(one)) == sizeof(one));
+            }
+#endif
+        };
+
+        void clearEventFD()
+        {
+#if defined(__linux__)
+            if ((m_eventFD >= 0) && m_eventSet && queue.empty() && !m_closed)
+            {
+                uint64_t count;
+                m_eventSet = (::read(m_eventFD, &count, sizeof(count)) != sizeof(count));
+            }
+#endif
+        };
+
         bool m_blocking;
         size_t m_size;
-        std::mutex mutex;
-        std::condition_variable cond_var;
-        std::queue<T> queue;
+        ProfiledLock<LockPolicy> mutex;
+        typename LockCondition<ProfiledLock<LockPolicy>>::type cond_var;
+        bool m_closed;
+        int m_eventFD;                          // Lazily created by getEventFD()
+        bool m_eventSet;                        // Is the eventfd currently readable?
+        std::conditional_t<(Capacity > 0), FixedRing<T, Capacity>, ChunkedQueue<T>> queue;
 };
\ No newline at end of file
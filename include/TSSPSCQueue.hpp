@@ -0,0 +1,229 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include <CacheLine.hpp>
+
+// Implement a lock-free, bounded, single-producer/single-consumer queue...
+//
+// This has the same push()/front()/pop() surface and the same blocking vs.
+// drop-oldest behavior as TSQueue, but it's backed by a fixed ring instead
+// of a mutex, condition variable and std::queue.  The common path is a
+// couple of atomic loads and stores- no locks, no syscalls, no allocations
+// after construction.
+//
+// The catch is in the name.  Exactly ONE thread may push() and exactly ONE
+// thread may front()/pop().  If you've got more than that on either end,
+// use TSQueue.
+//
+// Waiting (full in blocking mode, empty on front()) spins with a yield()-
+// this is meant for tight handoffs where the other side is actively
+// running, not for queues that sit idle for seconds.
+template <typename T> class TSSPSCQueue {
+    public:
+        /**
+         * Constructor.  The capacity is rounded up to the next power of two
+         * and is fixed for the life of the queue.
+         */
+        TSSPSCQueue(size_t size = 512, bool blocking = true) :
+            m_blocking(blocking), m_size(roundUp(size)), m_mask(m_size - 1),
+            m_ring(new T[m_size]), m_tail(0), m_headCache(0),
+            m_head(0), m_tailCache(0), m_claim(0), m_front(0) {};
+
+        /**
+         * Adds an item to the end of the queue.
+         * Producer side only.
+         *
+         * If the queue is full, this either waits for the consumer to make
+         * room (blocking) or throws the oldest entry on the floor.
+         *
+         * @param item The item to be added to the queue.
+         */
+        void push(const T& item)
+        {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+
+            if ((tail - m_headCache) >= m_size)
+            {
+                m_headCache = m_head.load(std::memory_order_acquire);
+                while ((tail - m_headCache) >= m_size)
+                {
+                    if (m_blocking)
+                    {
+                        std::this_thread::yield();
+                    }
+                    else
+                    {
+                        // Burn the front.  We have to take it from the consumer's side
+                        // with a CAS since they may be popping it right now...
+                        size_t head = m_headCache;
+                        if (m_head.compare_exchange_strong(head, head + 1, std::memory_order_seq_cst))
+                        {
+                            // ...and we can't overwrite the slot if they're holding a
+                            // reference to it from front().  Wait for them to let go.
+                            while (m_claim.load(std::memory_order_seq_cst) == (head + 1))
+                            {
+                                std::this_thread::yield();
+                            }
+                        }
+                    }
+                    m_headCache = m_head.load(std::memory_order_acquire);
+                }
+            }
+
+            m_ring[tail & m_mask] = item;
+            m_tail.store(tail + 1, std::memory_order_release);
+        };
+
+        /**
+         * Returns the item at the front of the queue, waiting for one if
+         * the queue is empty.
+         * Consumer side only.
+         *
+         * @return The item at the front of the queue.
+         */
+        T& front()
+        {
+            size_t head;
+
+            for (;;)
+            {
+                head = m_head.load(m_blocking ? std::memory_order_relaxed : std::memory_order_seq_cst);
+                if (head >= m_tailCache)
+                {
+                    m_tailCache = m_tail.load(std::memory_order_acquire);
+                    if (head >= m_tailCache)
+                    {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                }
+
+                if (m_blocking)
+                {
+                    break;
+                }
+
+                // Non-blocking mode- tell the producer we're looking at this slot, then make
+                // sure it didn't get dropped out from under us in the meantime.
+                m_claim.store(head + 1, std::memory_order_seq_cst);
+                if (m_head.load(std::memory_order_seq_cst) == head)
+                {
+                    break;
+                }
+            }
+
+            m_front = head;
+            return m_ring[head & m_mask];
+        };
+
+        /**
+         * Removes the item at the front of the queue.
+         * Consumer side only.
+         */
+        void pop()
+        {
+            // Either way, the slot gets reset before the producer can have it
+            // back, so whatever the entry holds is let go of now rather than
+            // whenever the ring wraps around to it again.
+            if (m_blocking)
+            {
+                size_t head = m_head.load(std::memory_order_relaxed);
+                if (head != m_tail.load(std::memory_order_acquire))
+                {
+                    m_ring[head & m_mask] = T();
+                    m_head.store(head + 1, std::memory_order_release);
+                }
+            }
+            else
+            {
+                // The producer may drop the front entry and reuse its slot at
+                // any time, unless we've claimed it.  front() already did; if
+                // it wasn't called, claim the front the same way it does.
+                size_t head = m_front;
+                if (m_claim.load(std::memory_order_relaxed) == 0)
+                {
+                    for (;;)
+                    {
+                        head = m_head.load(std::memory_order_seq_cst);
+                        if (head == m_tail.load(std::memory_order_acquire))
+                        {
+                            m_claim.store(0, std::memory_order_release);
+                            return;
+                        }
+                        m_claim.store(head + 1, std::memory_order_seq_cst);
+                        if (m_head.load(std::memory_order_seq_cst) == head)
+                        {
+                            break;
+                        }
+                    }
+                }
+
+                // If the producer already dropped this entry, the CAS fails and
+                // that entry is gone either way- which is what we want.
+                m_ring[head & m_mask] = T();
+                m_head.compare_exchange_strong(head, head + 1, std::memory_order_seq_cst);
+                m_claim.store(0, std::memory_order_release);
+            }
+        };
+
+        /**
+         * Checks if the queue is empty.
+         *
+         * @return True if the queue is empty, otherwise false.
+         */
+        bool empty()
+        {
+            return size() == 0;
+        }
+
+        /**
+         * Returns the current size of the queue.  If called from a thread
+         * other than the producer or consumer, this is only a snapshot.
+         *
+         * @return The current size of the queue.
+         */
+        size_t size()
+        {
+            size_t head = m_head.load(std::memory_order_acquire);
+            size_t tail = m_tail.load(std::memory_order_acquire);
+            return (tail > head) ? (tail - head) : 0;
+        }
+
+        /**
+         * Returns the (power of two) capacity of the queue.
+         */
+        size_t capacity() const
+        {
+            return m_size;
+        }
+
+    private:
+        static size_t roundUp(size_t size)
+        {
+            size_t retVal = 1;
+            while (retVal < size)
+            {
+                retVal <<= 1;
+            }
+            return retVal;
+        }
+
+        // Read-only after construction...
+        const bool m_blocking;
+        const size_t m_size;
+        const size_t m_mask;
+        std::unique_ptr<T[]> m_ring;
+
+        // Producer's cache line...
+        alignas(CACHELINE_SIZE) std::atomic<size_t> m_tail;
+        size_t m_headCache;
+
+        // Consumer's cache line...
+        alignas(CACHELINE_SIZE) std::atomic<size_t> m_head;
+        size_t m_tailCache;
+        std::atomic<size_t> m_claim;            // Slot+1 the consumer holds a front() reference on (non-blocking only)
+        size_t m_front;
+};
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <initializer_list>
+#include <mutex>
+#include <vector>
+
+// Go-style select across several queues...
+//
+// A Runable that has to service a handful of queues can block on all of them
+// at once instead of polling with sleep() or burning a thread per queue:
+//
+//     switch (TSSelect::wait_for({ &cmdQueue, &serialQueue, &gpioQueue }, milliseconds(50)))
+//     {
+//         case 0 : ... cmdQueue.try_pop() ... break;
+//         case 1 : ... serialQueue.try_pop() ... break;
+//         case 2 : ... gpioQueue.try_pop() ... break;
+//         case TSSelect::TIMEOUT : ... timer work ... break;
+//     }
+//
+// The index returned is the queue that had something in it when we looked.
+// If there are other consumers on that queue, they may get to it first, so
+// follow up with try_pop() rather than front()/pop().  When more than one
+// queue is ready, the one reported rotates so a busy queue can't starve the
+// others.
+
+class TSSelect;
+
+// Internal wakeup target for a thread blocked in TSSelect.
+struct TSSelectWaiter
+{
+    std::mutex lock;
+    std::condition_variable cond_var;
+    bool signalled = false;
+
+    void signal()
+    {
+        {
+            std::lock_guard guard(lock);
+            signalled = true;
+        }
+        cond_var.notify_one();
+    };
+};
+
+// Anything TSSelect can wait on.  Derived queues tell us when they've got
+// something via ready(), and call notifySelectors() after each push once
+// they've dropped their own lock.
+class TSSelectable
+{
+    public:
+        virtual ~TSSelectable() {};
+
+        /// True if the queue has an entry in it right now.
+        virtual bool ready() = 0;
+
+    protected:
+        TSSelectable() : m_waiterCount(0) {};
+
+        /// Wakes any threads selecting on us.  Costs one atomic load when
+        /// nobody is.
+        void notifySelectors()
+        {
+            if (m_waiterCount.load(std::memory_order_acquire) > 0)
+            {
+                std::lock_guard guard(m_waiterLock);
+                for (TSSelectWaiter *waiter : m_waiters)
+                {
+                    waiter->signal();
+                }
+            }
+        };
+
+    private:
+        friend class TSSelect;
+
+        void attach(TSSelectWaiter *waiter)
+        {
+            std::lock_guard guard(m_waiterLock);
+            m_waiters.push_back(waiter);
+            m_waiterCount.fetch_add(1, std::memory_order_release);
+        };
+
+        void detach(TSSelectWaiter *waiter)
+        {
+            std::lock_guard guard(m_waiterLock);
+            m_waiters.erase(std::remove(m_waiters.begin(), m_waiters.end(), waiter), m_waiters.end());
+            m_waiterCount.fetch_sub(1, std::memory_order_release);
+        };
+
+        std::atomic<size_t> m_waiterCount;
+        std::mutex m_waiterLock;
+        std::vector<TSSelectWaiter *> m_waiters;
+};
+
+class TSSelect
+{
+    public:
+        /// Returned by the timed waits when nothing became ready in time.
+        static const int TIMEOUT = -1;
+
+        /**
+         * Waits until one of the queues has an entry in it.
+         *
+         * @param queues The queues to wait on.
+         *
+         * @return The index into queues of a queue that's ready.
+         */
+        static int wait(std::initializer_list<TSSelectable *> queues)
+        {
+            return waitUntil(queues.begin(), queues.size(), NULL);
+        };
+
+        static int wait(const std::vector<TSSelectable *>& queues)
+        {
+            return waitUntil(queues.data(), queues.size(), NULL);
+        };
+
+        /**
+         * Waits at most timeout for one of the queues to have an entry in it.
+         *
+         * @param queues The queues to wait on.
+         * @param timeout The longest to wait.
+         *
+         * @return The index into queues of a queue that's ready, or TIMEOUT.
+         */
+        template <typename Rep, typename Period>
+            static int wait_for(std::initializer_list<TSSelectable *> queues, const std::chrono::duration<Rep, Period>& timeout)
+        {
+            std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+            return waitUntil(queues.begin(), queues.size(), &deadline);
+        };
+
+        template <typename Rep, typename Period>
+            static int wait_for(const std::vector<TSSelectable *>& queues, const std::chrono::duration<Rep, Period>& timeout)
+        {
+            std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+            return waitUntil(queues.data(), queues.size(), &deadline);
+        };
+
+    private:
+        // Looks for a ready queue, starting at a different spot each call.
+        static int scan(TSSelectable * const *queues, size_t count)
+        {
+            static thread_local size_t rotor = 0;
+
+            rotor++;
+            for (size_t i = 0; i < count; i++)
+            {
+                size_t index = (rotor + i) % count;
+                if (queues[index]->ready())
+                {
+                    return (int) index;
+                }
+            }
+            return TIMEOUT;
+        };
+
+        static int waitUntil(TSSelectable * const *queues, size_t count, const std::chrono::steady_clock::time_point *deadline)
+        {
+            // Don't bother with the wakeup machinery if something's already there.
+            int retVal = scan(queues, count);
+            if ((retVal != TIMEOUT) || (count == 0))
+            {
+                return retVal;
+            }
+
+            // Get on everyone's wakeup list, and THEN look again, so a push that
+            // lands in between can't slip past us.
+            TSSelectWaiter waiter;
+            for (size_t i = 0; i < count; i++)
+            {
+                queues[i]->attach(&waiter);
+            }
+
+            for (;;)
+            {
+                retVal = scan(queues, count);
+                if (retVal != TIMEOUT)
+                {
+                    break;
+                }
+
+                std::unique_lock lock(waiter.lock);
+                if (deadline == NULL)
+                {
+                    waiter.cond_var.wait(lock, [&]{ return waiter.signalled; });
+                }
+                else if (!waiter.cond_var.wait_until(lock, *deadline, [&]{ return waiter.signalled; }))
+                {
+                    lock.unlock();
+                    retVal = scan(queues, count);
+                    break;
+                }
+                waiter.signalled = false;
+            }
+
+            for (size_t i = 0; i < count; i++)
+            {
+                queues[i]->detach(&waiter);
+            }
+            return retVal;
+        };
+};
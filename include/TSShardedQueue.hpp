@@ -0,0 +1,285 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include <CacheLine.hpp>
+#include <ChunkedQueue.hpp>
+#include <LockCondition.hpp>
+#include <TSSleepers.hpp>
+
+// Implement a sharded, multi-lane threadsafe queue...
+//
+// A dozen producers hammering one TSQueue all serialize on its one mutex and
+// its one cache line.  Here each producer thread is pinned to one of several
+// lanes (each with its own lock, on its own cache line), so producers only
+// contend when they share a lane.  Consumers sweep the lanes round-robin, or
+// scoop up a batch across them with pop_bulk().
+//
+// Ordering is per-lane FIFO.  Everything one producer pushes comes out in
+// the order it went in, but there's no ordering between producers- which
+// TSQueue never really promised with more than one of them anyway.
+//
+// Capacity is split evenly across the lanes, and a full lane follows the
+// usual blocking vs. drop-oldest policy on its own.  The push/pop API is
+// TSQueue's consume-by-value one; there's no front()/pop() pair because
+// there's no single front.  LockPolicy picks the lanes' (and the sleepers')
+// lock, as with TSQueue.
+template <typename T, typename LockPolicy = std::mutex> class TSShardedQueue {
+    public:
+        /**
+         * Constructor
+         *
+         * @param size Total capacity, split between the lanes.
+         * @param blocking Whether a full lane waits (true) or drops its oldest entry.
+         * @param lanes Number of lanes- defaults to one per hardware thread.
+         */
+        TSShardedQueue(size_t size = 512, bool blocking = true, size_t lanes = 0) :
+            m_blocking(blocking),
+            m_laneCount((lanes > 0) ? lanes : ((std::thread::hardware_concurrency() > 0) ? std::thread::hardware_concurrency() : 4)),
+            m_laneSize(((size + m_laneCount - 1) / m_laneCount) > 0 ? ((size + m_laneCount - 1) / m_laneCount) : 1),
+            m_lanes(new Lane[m_laneCount]), m_closed(false) {};
+
+        /**
+         * Adds an item to the end of the calling thread's lane.
+         * This method is thread-safe.
+         *
+         * @param item The item to be added to the queue.
+         *
+         * @return true if the item was added, false if the queue is closed.
+         */
+        bool push(const T& item)                    { return emplace(item); };
+        bool push(T&& item)                         { return emplace(std::move(item)); };
+
+        /**
+         * Constructs an item in place at the end of the calling thread's lane.
+         * This method is thread-safe.
+         *
+         * @param args The arguments to construct the item with.
+         *
+         * @return true if the item was added, false if the queue is closed.
+         */
+        template <typename... Args> bool emplace(Args&&... args)
+        {
+            Lane &lane = m_lanes[producerLane()];
+
+            {
+                std::unique_lock lock(lane.lock);
+                if (m_closed.load())
+                {
+                    return false;
+                }
+                if (lane.queue.size() >= m_laneSize)
+                {
+                    if (m_blocking)
+                    {
+                        // Wait until there is room
+                        lane.waiting++;
+                        lane.room.wait(lock, [&]{ return (lane.queue.size() < m_laneSize) || m_closed.load(); });
+                        lane.waiting--;
+                    }
+                    else
+                    {
+                        // Burn the front.  Throw it on the floor.  We're full and this isn't blocking.
+                        lane.queue.pop();
+                    }
+                }
+                if (m_closed.load())
+                {
+                    return false;
+                }
+                lane.queue.emplace(std::forward<Args>(args)...);
+            }
+
+            m_sleepers.wake_one();
+            return true;
+        };
+
+        /**
+         * Removes the next item, sweeping the lanes round-robin, if there
+         * is one.  This never waits.
+         * This method is thread-safe.
+         *
+         * @return The item, or nothing if every lane was empty.
+         */
+        std::optional<T> try_pop()
+        {
+            std::optional<T> retVal;
+            take([&](T& item) { retVal.emplace(std::move(item)); return false; });
+            return retVal;
+        };
+
+        /**
+         * Removes the next item, waiting at most timeout for one.
+         * This method is thread-safe.
+         *
+         * @param timeout The longest to wait for an item.
+         *
+         * @return The item, or nothing if we timed out or the queue is
+         *         closed and empty.
+         */
+        template <typename Rep, typename Period>
+            std::optional<T> pop_for(const std::chrono::duration<Rep, Period>& timeout)
+        {
+            std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+            std::optional<T> retVal;
+            waitFor([&]{ return take([&](T& item) { retVal.emplace(std::move(item)); return false; }) > 0; }, &deadline);
+            return retVal;
+        };
+
+        /**
+         * Removes the next item, waiting as long as it takes for one.
+         * This method is thread-safe.
+         *
+         * @return The item, or nothing if the queue is closed and empty.
+         */
+        std::optional<T> pop_wait()
+        {
+            std::optional<T> retVal;
+            waitFor([&]{ return take([&](T& item) { retVal.emplace(std::move(item)); return false; }) > 0; }, NULL);
+            return retVal;
+        };
+
+        /**
+         * Removes up to max items, collected across the lanes, waiting for
+         * at least one if they're all empty.  Each lane's lock is taken once.
+         * This method is thread-safe.
+         *
+         * @param out Where to put the items.
+         * @param max The most items to remove.
+         *
+         * @return The number of items removed.  Zero only if the queue is
+         *         closed and empty (or max was zero).
+         */
+        template <typename OutputIt> size_t pop_bulk(OutputIt out, size_t max)
+        {
+            size_t count = 0;
+
+            if (max > 0)
+            {
+                waitFor([&]
+                {
+                    size_t taken = 0;
+                    count = take([&](T& item) { *out++ = std::move(item); return ++taken < max; });
+                    return count > 0;
+                }, NULL);
+            }
+            return count;
+        };
+
+        /**
+         * Closes the queue, waking everyone blocked on it.  Pushes are
+         * refused from then on; consumers get what's left, then nothing.
+         * This method is thread-safe.
+         */
+        void close()
+        {
+            m_closed.store(true);
+            for (size_t i = 0; i < m_laneCount; i++)
+            {
+                std::lock_guard lock(m_lanes[i].lock);
+                m_lanes[i].room.notify_all();
+            }
+            m_sleepers.wake_all();
+        };
+
+        /// Number of lanes.
+        size_t lanes() const                        { return m_laneCount; };
+
+        /// Checks if every lane is empty.  This is only a snapshot.
+        bool empty()                                { return size() == 0; };
+
+        /// Returns the number of items across all lanes.  This is only a snapshot.
+        size_t size()
+        {
+            size_t retVal = 0;
+            for (size_t i = 0; i < m_laneCount; i++)
+            {
+                std::lock_guard lock(m_lanes[i].lock);
+                retVal += m_lanes[i].queue.size();
+            }
+            return retVal;
+        };
+
+    private:
+        struct alignas(CACHELINE_SIZE) Lane
+        {
+            LockPolicy lock;
+            typename LockCondition<LockPolicy>::type room;       // Producers waiting on a full lane...
+            size_t waiting = 0;                 // ...and how many of them there are
+            ChunkedQueue<T> queue;
+        };
+
+        // Each producer thread gets a number the first time it pushes to any
+        // TSShardedQueue, and sticks to that lane from then on.
+        size_t producerLane() const
+        {
+            static std::atomic<size_t> nextProducer(0);
+            static thread_local size_t producer = nextProducer.fetch_add(1, std::memory_order_relaxed);
+            return producer % m_laneCount;
+        };
+
+        // Sweeps the lanes starting where this consumer left off, handing items
+        // to give() until it returns false or we've been round once.  Returns
+        // the number of items handed over.
+        template <typename F> size_t take(F give)
+        {
+            static thread_local size_t rotor = 0;
+            size_t count = 0;
+            bool more = true;
+
+            for (size_t i = 0; (i < m_laneCount) && more; i++)
+            {
+                Lane &lane = m_lanes[(rotor + i) % m_laneCount];
+                size_t taken = 0;
+                size_t waiting = 0;
+                {
+                    std::lock_guard lock(lane.lock);
+                    waiting = lane.waiting;
+                    while (more && !lane.queue.empty())
+                    {
+                        more = give(lane.queue.front());
+                        lane.queue.pop();
+                        taken++;
+                    }
+                }
+                if ((waiting > 0) && (taken > 0))
+                {
+                    // Only as many producers as we made room for can get in.
+                    if (taken == 1)
+                    {
+                        lane.room.notify_one();
+                    }
+                    else
+                    {
+                        lane.room.notify_all();
+                    }
+                }
+                count += taken;
+            }
+            rotor++;
+            return count;
+        };
+
+        // Runs attempt() until it succeeds, the queue is closed (and attempt()
+        // still comes up empty), or we pass the deadline, sleeping in between.
+        template <typename F> void waitFor(F attempt, const std::chrono::steady_clock::time_point *deadline)
+        {
+            m_sleepers.wait(attempt, [&]{ return m_closed.load(); }, deadline);
+        };
+
+        // Read-only after construction...
+        const bool m_blocking;
+        const size_t m_laneCount;
+        const size_t m_laneSize;
+        std::unique_ptr<Lane[]> m_lanes;
+
+        // Consumer sleep/wakeup...
+        TSSleepers<LockPolicy> m_sleepers;
+        std::atomic<bool> m_closed;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include <CacheLine.hpp>
+#include <LockCondition.hpp>
+
+// Where the consumers of a lock-per-shard queue go to sleep...
+//
+// TSShardedQueue and TSMultiQueue have no single lock for a consumer to wait
+// on, so an empty queue parks its consumers here instead.  A consumer looks
+// for work, and only if there's none does it count itself in as a sleeper and
+// look once more before it waits.  A producer, after its push, only goes near
+// the lock and condition variable if somebody's counted in- otherwise waking
+// nobody costs a fence and a load.
+//
+// LockPolicy is the lock the sleepers wait with, as for the queues.
+template <typename LockPolicy = std::mutex> class TSSleepers {
+    public:
+        TSSleepers() : m_count(0) {};
+
+        TSSleepers(const TSSleepers&) = delete;
+        TSSleepers& operator=(const TSSleepers&) = delete;
+
+        /**
+         * Runs attempt() until it succeeds, done() comes back true, or we
+         * pass the deadline, sleeping in between.  After a timeout attempt()
+         * gets one last try.
+         *
+         * @param attempt Looks for work; true if it found (and took) some.
+         * @param done True if there's no point waiting any more (closed).
+         * @param deadline When to give up, or NULL to wait as long as it takes.
+         */
+        template <typename Attempt, typename Done>
+            void wait(Attempt attempt, Done done, const std::chrono::steady_clock::time_point *deadline = NULL)
+        {
+            if (attempt())
+            {
+                return;
+            }
+
+            // Tell the producers someone's asleep BEFORE looking again, so a push
+            // that lands in between can't slip past us.
+            std::unique_lock<LockPolicy> lock(m_lock);
+            m_count.fetch_add(1);
+            for (;;)
+            {
+                if (attempt() || done())
+                {
+                    break;
+                }
+                if (deadline == NULL)
+                {
+                    m_wakeup.wait(lock);
+                }
+                else if (m_wakeup.wait_until(lock, *deadline) == std::cv_status::timeout)
+                {
+                    attempt();
+                    break;
+                }
+            }
+            m_count.fetch_sub(1);
+        };
+
+        /// Wakes one sleeper, if there are any.  Call after the push is visible.
+        void wake_one()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_count.load() > 0)
+            {
+                std::lock_guard<LockPolicy> lock(m_lock);
+                m_wakeup.notify_one();
+            }
+        };
+
+        /// Wakes every sleeper, for close().
+        void wake_all()
+        {
+            std::lock_guard<LockPolicy> lock(m_lock);
+            m_wakeup.notify_all();
+        };
+
+    private:
+        alignas(CACHELINE_SIZE) std::atomic<size_t> m_count;
+        LockPolicy m_lock;
+        typename LockCondition<LockPolicy>::type m_wakeup;
+};
@@ -0,0 +1,249 @@
+/*
+ * TimerWheel.hpp
+ *
+ * A hierarchical timing wheel timer service for C++, driven by a single
+ * Runable thread.
+ *
+ * This *requires* a 2017 C++ standard compliant compiler to compile and work.
+ *
+ * Copyright (c) 2024 Frank C. Earl
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.  You may add your
+ *    own copyright notice relative to your modifications, but you cannot claim
+ *    the code herein as solely your own.
+ *
+ * 2. Binary redistributions must reproduce the above copyright notice, either
+ *    in the initial output of the derived application, a "help" screen, or in
+ *    the documentation that accompanies the same.
+ *
+ * 3. Neither the name of the copyright holder nor the names of this software's
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.  Compliance with
+ *    condition 2 does not constitute a violation of this condition.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * SPECIFICALLY DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef INCLUDE_TIMERWHEEL_H_
+#define INCLUDE_TIMERWHEEL_H_
+
+#include <Runable.hpp>
+
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+#include <vector>
+
+/*
+ * Some notes:
+ *
+ * 		- Thousands of timers (blink patterns, serial retries, game timers...)
+ * 		  pushed as deadlines into a TSPriorityQueue cost O(log n) apiece and
+ * 		  leave you spinning to see if the front one's due.  This keeps them in
+ * 		  a hierarchical timing wheel instead- five levels of 64 slots, each
+ * 		  level's slot spanning 64 of the level below- so schedule() and
+ * 		  cancel() are O(1) linked-list operations.  Timers further out than
+ * 		  the wheel reaches (2^30 ticks) just get cascaded back down again.
+ * 		- One thread services the lot.  It works out the next tick anything can
+ * 		  happen on from a bitmap per level and sleeps until then (on a timerfd
+ * 		  under Linux, a condition variable elsewhere), so an idle wheel costs
+ * 		  nothing.  Scheduling something sooner wakes it to re-arm.
+ * 		- Callbacks run on the wheel's thread, one after another, with no
+ * 		  locks held, so they can schedule and cancel freely.  Keep them short-
+ * 		  a slow one delays everything behind it.  If the work is anything but
+ * 		  quick, enqueue() it onto a queue somebody else services instead.
+ * 		- Timers never fire early.  They fire on the first tick at or after
+ * 		  their deadline, so the resolution is the tick you construct us with.
+ */
+
+typedef std::function<void(void)> TimerCallback;
+
+class TimerWheel : public Runable
+{
+public:
+	// Refers to a scheduled timer for cancel().  A one-shot timer's handle
+	// goes stale once it's fired; a default Handle never refers to anything.
+	struct Handle
+	{
+		size_t		slot = SIZE_MAX;
+		uint32_t	generation = 0;
+
+		bool valid() const { return slot != SIZE_MAX; };
+	};
+
+	// Constructor- starts the service thread.  tick is the resolution.
+	TimerWheel(std::chrono::nanoseconds tick = std::chrono::milliseconds(1));
+
+	// Destructor...stops the service thread, dropping anything still scheduled.
+	virtual ~TimerWheel();
+
+	/**
+	 * Schedules callback to run once, delay from now.
+	 * This method is thread-safe.
+	 *
+	 * @param delay How long from now to fire.
+	 * @param callback What to run.
+	 *
+	 * @return The timer's handle, for cancel().
+	 */
+	template <typename Rep, typename Period>
+		Handle schedule(const std::chrono::duration<Rep, Period>& delay, TimerCallback callback)
+	{
+		return add(std::chrono::steady_clock::now() + delay, std::move(callback), std::chrono::nanoseconds::zero());
+	};
+
+	/**
+	 * Schedules callback to run once, at a given time.
+	 * This method is thread-safe.
+	 *
+	 * @param when When to fire.
+	 * @param callback What to run.
+	 *
+	 * @return The timer's handle, for cancel().
+	 */
+	Handle schedule_at(std::chrono::steady_clock::time_point when, TimerCallback callback)
+	{
+		return add(when, std::move(callback), std::chrono::nanoseconds::zero());
+	};
+
+	/**
+	 * Schedules callback to run every period, starting period from now,
+	 * until it's cancelled.  Each firing is scheduled off of the previous
+	 * deadline rather than when the callback ran, so it doesn't drift.
+	 * This method is thread-safe.
+	 *
+	 * @param period How often to fire.
+	 * @param callback What to run.
+	 *
+	 * @return The timer's handle, for cancel().
+	 */
+	template <typename Rep, typename Period>
+		Handle schedule_every(const std::chrono::duration<Rep, Period>& period, TimerCallback callback)
+	{
+		return add(std::chrono::steady_clock::now() + period, std::move(callback), period);
+	};
+
+	/**
+	 * Pushes item onto queue, delay from now.  Anything with a push() will
+	 * do- TSQueue, TSPriorityQueue, and the rest.  The queue has to outlive
+	 * the timer.
+	 * This method is thread-safe.
+	 *
+	 * @param delay How long from now to push.
+	 * @param queue Where to push it.
+	 * @param item What to push.
+	 *
+	 * @return The timer's handle, for cancel().
+	 */
+	template <typename Rep, typename Period, typename Queue, typename Item>
+		Handle enqueue(const std::chrono::duration<Rep, Period>& delay, Queue& queue, const Item& item)
+	{
+		return schedule(delay, [&queue, item]() { queue.push(item); });
+	};
+
+	/**
+	 * Cancels a timer.  A callback that's already on its way out keeps
+	 * going; a periodic timer cancelled from anywhere, including its own
+	 * callback, doesn't fire again.
+	 * This method is thread-safe.
+	 *
+	 * @param handle The timer, as returned by schedule() and friends.
+	 *
+	 * @return true if it was cancelled, false if it had already fired or
+	 *         been cancelled.
+	 */
+	bool cancel(const Handle& handle);
+
+	// Number of timers scheduled.  This is only a snapshot.
+	size_t pending(void);
+
+	// The resolution we were constructed with.
+	std::chrono::nanoseconds tick(void) const { return _tick; };
+
+	// Stops the service thread, waking it if it's asleep.
+	virtual void stop();
+
+protected:
+	virtual void run(void);
+
+private:
+	static const size_t		LEVEL_BITS = 6;
+	static const size_t		SLOTS = (1 << LEVEL_BITS);
+	static const size_t		LEVELS = 5;
+	static const uint32_t	NIL = UINT32_MAX;
+	static const uint64_t	IDLE = UINT64_MAX;
+
+	struct Node
+	{
+		TimerCallback	callback;
+		uint64_t		expiry;			// Tick to fire on
+		uint64_t		period;			// Ticks between firings, 0 for a one-shot
+		uint32_t		prev;
+		uint32_t		next;
+		uint32_t		generation;		// Bumped on every reuse, to spot stale handles
+		uint16_t		bucket;			// Level * SLOTS + slot we're linked into
+		bool			active;
+	};
+
+	struct Bucket
+	{
+		uint32_t		head = NIL;
+		uint32_t		tail = NIL;
+	};
+
+	Handle add(std::chrono::steady_clock::time_point when, TimerCallback callback, std::chrono::nanoseconds period);
+
+	// All of these are called with _lock held...
+	void link(uint32_t index);
+	void unlink(uint32_t index);
+	void release(uint32_t index);
+	uint64_t nextEvent(void);
+	void advance(uint64_t now);
+
+	void wake(void);
+	void sleepUntil(uint64_t tick);
+
+	uint64_t elapsedTicks(std::chrono::steady_clock::time_point when);
+
+	std::chrono::nanoseconds				_tick;
+	std::chrono::steady_clock::time_point	_start;			// Tick 0
+
+	mutex						_lock;
+	std::vector<Node>			_nodes;
+	std::vector<uint32_t>		_free;			// Nodes ready for reuse
+	Bucket						_buckets[LEVELS * SLOTS];
+	uint64_t					_occupied[LEVELS];	// Bit n set when slot n of the level has timers
+	uint64_t					_current;		// Last tick we've processed
+	uint64_t					_armed;			// Tick the thread's sleeping until, IDLE for indefinitely
+	size_t						_pending;
+	atomic<bool>				_shutdown;		// Set once, by the destructor
+
+	std::vector<TimerCallback>	_firing;		// Only touched by the service thread
+
+#if defined(__linux__)
+	int							_timerFD;
+	int							_wakeFD;
+#else
+	condition_variable			_wakeup;
+	bool						_poked;
+#endif
+};
+
+#endif /* INCLUDE_TIMERWHEEL_H_ */
@@ -0,0 +1,570 @@
+// Throughput comparisons for the library's containers.  Not a test- it
+// doesn't check anything.  Build it with -DBUILD_BENCHMARKS=ON and run it
+// on the target you care about; the numbers only mean something relative
+// to each other on the same box.
+
+#include <TSQueue.hpp>
+#include <TSSPSCQueue.hpp>
+#include <TSMPMCQueue.hpp>
+#include <TSShardedQueue.hpp>
+#include <TSPriorityQueue.hpp>
+#include <TSMultiQueue.hpp>
+#include <TimerWheel.hpp>
+#include <AtomicMtx.hpp>
+#include <FairMtx.hpp>
+#include <FutexMtx.hpp>
+#include <LockPolicy.hpp>
+#include <RWSpinMtx.hpp>
+#include <SeqLocked.hpp>
+#include <ShardedSingleton.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+using std::atomic;
+using std::thread;
+using std::vector;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+
+// One producer thread, one consumer (the calling thread), count items
+// through the queue.  Returns millions of items per second.
+template <typename Q>
+static double spscRun(Q &queue, size_t count)
+{
+	volatile size_t sum = 0;
+	auto start = steady_clock::now();
+
+	thread producer([&]
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			queue.push(i);
+		}
+	});
+
+	for (size_t i = 0; i < count; i++)
+	{
+		sum = sum + queue.front();
+		queue.pop();
+	}
+	producer.join();
+
+	duration<double> elapsed = steady_clock::now() - start;
+	return (count / elapsed.count()) / 1e6;
+}
+
+static void benchSPSC(size_t count)
+{
+	printf("SPSC handoff, %zu items\n", count);
+	for (size_t depth : { 64, 1024 })
+	{
+		TSQueue<size_t> mtxQueue(depth);
+		TSSPSCQueue<size_t> ringQueue(depth);
+
+		printf("  %-30s depth %5zu : %8.2f Mitems/s\n", "TSQueue (mutex)", depth, spscRun(mtxQueue, count));
+		printf("  %-30s depth %5zu : %8.2f Mitems/s\n", "TSSPSCQueue (ring)", depth, spscRun(ringQueue, count));
+	}
+	printf("\n");
+}
+
+// producers threads split count items between them, consumers threads
+// take them with try_pop() until all of them are through.  Returns millions
+// of items per second.
+template <typename Q>
+static double fanRun(Q &queue, size_t count, size_t producers, size_t consumers)
+{
+	atomic<size_t> taken(0);
+	vector<thread> threads;
+	size_t each = count / producers;
+	size_t total = each * producers;
+	auto start = steady_clock::now();
+
+	for (size_t p = 0; p < producers; p++)
+	{
+		threads.emplace_back([&]
+		{
+			for (size_t i = 0; i < each; i++)
+			{
+				queue.push(i);
+			}
+		});
+	}
+
+	for (size_t c = 0; c < consumers; c++)
+	{
+		threads.emplace_back([&]
+		{
+			while (taken.load(std::memory_order_relaxed) < total)
+			{
+				if (queue.try_pop())
+				{
+					taken.fetch_add(1, std::memory_order_relaxed);
+				}
+				else
+				{
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+
+	for (auto &t : threads)
+	{
+		t.join();
+	}
+
+	duration<double> elapsed = steady_clock::now() - start;
+	return (total / elapsed.count()) / 1e6;
+}
+
+static void benchFan(size_t count)
+{
+	printf("N producers -> N consumers, %zu items\n", count);
+	for (size_t threads : { 1, 2, 4, 8 })
+	{
+		TSQueue<size_t> mtxQueue(1024);
+		TSMPMCQueue<size_t> mpmcQueue(1024);
+
+		printf("  %-30s %2zu x %2zu : %8.2f Mitems/s\n", "TSQueue (mutex)", threads, threads, fanRun(mtxQueue, count, threads, threads));
+		printf("  %-30s %2zu x %2zu : %8.2f Mitems/s\n", "TSMPMCQueue (Vyukov)", threads, threads, fanRun(mpmcQueue, count, threads, threads));
+	}
+	printf("\n");
+}
+
+static void benchSharded(size_t count)
+{
+	printf("N producers -> 1 consumer, sharded lanes, %zu items\n", count);
+	for (size_t producers : { 1, 2, 4, 8, 12 })
+	{
+		TSQueue<size_t> mtxQueue(1024);
+		TSShardedQueue<size_t> shardQueue(1024);
+
+		printf("  %-30s %2zu producers : %8.2f Mitems/s\n", "TSQueue (mutex)", producers, fanRun(mtxQueue, count, producers, 1));
+		printf("  %-30s %2zu producers : %8.2f Mitems/s\n", "TSShardedQueue", producers, fanRun(shardQueue, count, producers, 1));
+	}
+	printf("\n");
+}
+
+// threads threads each do their share of count push + try_pop pairs on a
+// priority queue.  Returns millions of pairs per second.
+template <typename Q>
+static double mixedRun(Q &queue, size_t count, size_t threads)
+{
+	vector<thread> workers;
+	size_t each = count / threads;
+	auto start = steady_clock::now();
+
+	for (size_t t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&, t]
+		{
+			size_t key = t + 1;
+			for (size_t i = 0; i < each; i++)
+			{
+				key = (key * 6364136223846793005ULL) + 1442695040888963407ULL;
+				queue.push(key >> 40);
+				queue.try_pop();
+			}
+		});
+	}
+	for (auto &w : workers)
+	{
+		w.join();
+	}
+
+	duration<double> elapsed = steady_clock::now() - start;
+	return ((each * threads) / elapsed.count()) / 1e6;
+}
+
+// 256 priority levels out of the random keys, for the bucketed queue.
+struct LowByte
+{
+	size_t operator()(size_t key) const { return key & 0xff; }
+};
+
+static void benchPriority(size_t count)
+{
+	printf("Priority queue push+pop pairs, %zu pairs, 1000 prefilled\n", count);
+	for (size_t threads : { 1, 4, 16 })
+	{
+		TSPriorityQueue<size_t> heapQueue;
+		TSPriorityQueue<size_t, 0, PriorityLevels<256, LowByte>> bucketQueue;
+		TSMultiQueue<size_t> multiQueue;
+		TSMultiQueue<size_t> strictQueue(false);
+		for (size_t i = 0; i < 1000; i++)
+		{
+			heapQueue.push(i);
+			bucketQueue.push(i);
+			multiQueue.push(i);
+			strictQueue.push(i);
+		}
+
+		printf("  %-30s %2zu threads : %8.2f Mpairs/s\n", "TSPriorityQueue (one heap)", threads, mixedRun(heapQueue, count, threads));
+		printf("  %-30s %2zu threads : %8.2f Mpairs/s\n", "TSPriorityQueue (256 buckets)", threads, mixedRun(bucketQueue, count, threads));
+		printf("  %-30s %2zu threads : %8.2f Mpairs/s\n", "TSMultiQueue (relaxed)", threads, mixedRun(multiQueue, count, threads));
+		printf("  %-30s %2zu threads : %8.2f Mpairs/s\n", "TSMultiQueue (strict)", threads, mixedRun(strictQueue, count, threads));
+	}
+	printf("\n");
+}
+
+// Same handoff as spscRun(), but moving batch items per lock round-trip.
+static double batchRun(TSQueue<size_t> &queue, size_t count, size_t batch)
+{
+	volatile size_t sum = 0;
+	auto start = steady_clock::now();
+
+	thread producer([&]
+	{
+		vector<size_t> items(batch);
+		for (size_t i = 0; i < count; i += batch)
+		{
+			queue.push_bulk(items.begin(), items.begin() + std::min(batch, count - i));
+		}
+	});
+
+	vector<size_t> items(batch);
+	for (size_t i = 0; i < count; )
+	{
+		size_t got = queue.pop_bulk(items.begin(), batch);
+		for (size_t j = 0; j < got; j++)
+		{
+			sum = sum + items[j];
+		}
+		i += got;
+	}
+	producer.join();
+
+	duration<double> elapsed = steady_clock::now() - start;
+	return (count / elapsed.count()) / 1e6;
+}
+
+static void benchBatch(size_t count)
+{
+	printf("TSQueue batched handoff, %zu items\n", count);
+	for (size_t batch : { 1, 16, 256 })
+	{
+		TSQueue<size_t> mtxQueue(1024);
+
+		printf("  %-30s batch %5zu : %8.2f Mitems/s\n", "TSQueue push_bulk/pop_bulk", batch, batchRun(mtxQueue, count, batch));
+	}
+	printf("\n");
+}
+
+// Arms count timers 1ms to 10s out and cancels them all- the retry-timer
+// pattern, where almost nothing actually fires.  Deadlines in a
+// TSPriorityQueue (push, then erase by handle) against the TimerWheel.
+static void benchTimers(size_t count)
+{
+	printf("Timer schedule+cancel, %zu timers\n", count);
+
+	vector<size_t> delays(count);
+	size_t key = 1;
+	for (size_t i = 0; i < count; i++)
+	{
+		key = (key * 6364136223846793005ULL) + 1442695040888963407ULL;
+		delays[i] = 1 + ((key >> 33) % 10000);
+	}
+
+	{
+		TSPriorityQueue<steady_clock::time_point, 0, std::greater<steady_clock::time_point>> deadlines;
+		vector<TSPriorityQueue<steady_clock::time_point, 0, std::greater<steady_clock::time_point>>::Handle> handles(count);
+		auto start = steady_clock::now();
+		for (size_t i = 0; i < count; i++)
+		{
+			handles[i] = deadlines.push(steady_clock::now() + std::chrono::milliseconds(delays[i]));
+		}
+		for (size_t i = 0; i < count; i++)
+		{
+			deadlines.erase(handles[i]);
+		}
+		duration<double> elapsed = steady_clock::now() - start;
+		printf("  %-30s : %8.2f Mtimers/s\n", "TSPriorityQueue deadlines", (count / elapsed.count()) / 1e6);
+	}
+
+	{
+		TimerWheel wheel;
+		vector<TimerWheel::Handle> handles(count);
+		auto start = steady_clock::now();
+		for (size_t i = 0; i < count; i++)
+		{
+			handles[i] = wheel.schedule(std::chrono::milliseconds(delays[i]), []{});
+		}
+		for (size_t i = 0; i < count; i++)
+		{
+			wheel.cancel(handles[i]);
+		}
+		duration<double> elapsed = steady_clock::now() - start;
+		printf("  %-30s : %8.2f Mtimers/s\n", "TimerWheel", (count / elapsed.count()) / 1e6);
+	}
+	printf("\n");
+}
+
+// threads threads each take the lock count / threads times to bump a shared
+// counter- a critical section about as short as they come.  Every lock() is
+// timed, and the longest any one of them waited says how fair the lock is.
+struct LockResult
+{
+	double rate;		// Millions of acquisitions per second
+	double maxWait;		// Longest single lock(), in microseconds
+};
+
+template <typename L>
+static LockResult lockRun(L &lock, size_t count, size_t threads)
+{
+	vector<thread> workers;
+	vector<double> maxWaits(threads, 0);
+	size_t each = count / threads;
+	volatile size_t counter = 0;
+	auto start = steady_clock::now();
+
+	for (size_t t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&, t]
+		{
+			double longest = 0;
+			for (size_t i = 0; i < each; i++)
+			{
+				auto asked = steady_clock::now();
+				lock.lock();
+				duration<double, std::micro> waited = steady_clock::now() - asked;
+				counter = counter + 1;
+				lock.unlock();
+				longest = std::max(longest, waited.count());
+			}
+			maxWaits[t] = longest;
+		});
+	}
+	for (auto &w : workers)
+	{
+		w.join();
+	}
+
+	duration<double> elapsed = steady_clock::now() - start;
+	return { ((each * threads) / elapsed.count()) / 1e6, *std::max_element(maxWaits.begin(), maxWaits.end()) };
+}
+
+template <typename L>
+static void lockLine(const char *name, size_t count, size_t threads)
+{
+	L lock;
+	LockResult result = lockRun(lock, count, threads);
+	printf("  %-30s %2zu threads : %8.2f Mlocks/s, max wait %9.1f us\n", name, threads, result.rate, result.maxWait);
+}
+
+static void benchLocks(size_t count)
+{
+	printf("Lock acquire/release, %zu acquisitions\n", count);
+	for (size_t threads : { 1, 4, 16 })
+	{
+		lockLine<AtomicMtx>("AtomicMtx", count, threads);
+		lockLine<TicketMtx>("TicketMtx", count, threads);
+		lockLine<MCSMtx>("MCSMtx", count, threads);
+		lockLine<FutexMtx>("FutexMtx", count, threads);
+		lockLine<std::mutex>("std::mutex", count, threads);
+	}
+	printf("\n");
+}
+
+// Read-mostly state: threads readers copy a small settings block count /
+// threads times each while one writer changes it every 1000th of that.
+struct BenchSettings
+{
+	int baud;
+	int bits;
+	int stop;
+	char parity;
+};
+
+template <typename Read, typename Write>
+static void readLine(const char *name, size_t count, size_t threads, Read read, Write write)
+{
+	vector<thread> readers;
+	std::atomic<bool> done(false);
+	size_t each = count / threads;
+	auto start = steady_clock::now();
+
+	for (size_t t = 0; t < threads; t++)
+	{
+		readers.emplace_back([&]
+		{
+			volatile int sink = 0;
+			for (size_t i = 0; i < each; i++)
+			{
+				sink = sink + read().baud;
+			}
+		});
+	}
+	thread writer([&]
+	{
+		for (int i = 0; !done.load(std::memory_order_relaxed); i++)
+		{
+			write(BenchSettings{ i, 8, 1, 'N' });
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+	});
+	for (auto &r : readers)
+	{
+		r.join();
+	}
+	duration<double> elapsed = steady_clock::now() - start;
+	done = true;
+	writer.join();
+	printf("  %-30s %2zu threads : %8.2f Mreads/s\n", name, threads, ((each * threads) / elapsed.count()) / 1e6);
+}
+
+template <typename L>
+static void lockedReadLine(const char *name, size_t count, size_t threads)
+{
+	L lock;
+	BenchSettings settings{ 9600, 8, 1, 'N' };
+	readLine(name, count, threads,
+		[&]{ lock_guard<L> guard(lock); return settings; },
+		[&](const BenchSettings &value){ lock_guard<L> guard(lock); settings = value; });
+}
+
+template <typename L>
+static void sharedReadLine(const char *name, size_t count, size_t threads)
+{
+	L lock;
+	BenchSettings settings{ 9600, 8, 1, 'N' };
+	readLine(name, count, threads,
+		[&]{ std::shared_lock<L> guard(lock); return settings; },
+		[&](const BenchSettings &value){ lock_guard<L> guard(lock); settings = value; });
+}
+
+static void benchReadMostly(size_t count)
+{
+	printf("Read-mostly state, %zu reads\n", count);
+	for (size_t threads : { 1, 4 })
+	{
+		lockedReadLine<std::mutex>("std::mutex", count, threads);
+		lockedReadLine<AtomicMtx>("AtomicMtx", count, threads);
+		sharedReadLine<std::shared_mutex>("std::shared_mutex", count, threads);
+		sharedReadLine<RWSpinMtx>("RWSpinMtx", count, threads);
+
+		SeqLocked<BenchSettings> settings(BenchSettings{ 9600, 8, 1, 'N' });
+		readLine("SeqLocked", count, threads,
+			[&]{ return settings.load(); },
+			[&](const BenchSettings &value){ settings.store(value); });
+	}
+	printf("\n");
+}
+
+// What the lock alone costs a TSQueue: one thread pushes and pops count
+// items in runs of 64, so nothing ever waits and there's no contention.
+template <typename L>
+static void policyLine(const char *name, size_t count)
+{
+	TSQueue<size_t, 64, L> queue;
+	volatile size_t sum = 0;
+	auto start = steady_clock::now();
+
+	for (size_t i = 0; i < count; i += 64)
+	{
+		for (size_t j = 0; j < 64; j++)
+		{
+			queue.push(i + j);
+		}
+		for (size_t j = 0; j < 64; j++)
+		{
+			sum = sum + *queue.try_pop();
+		}
+	}
+
+	duration<double> elapsed = steady_clock::now() - start;
+	printf("  %-30s : %8.2f Mitems/s\n", name, (count / elapsed.count()) / 1e6);
+}
+
+static void benchPolicies(size_t count)
+{
+	printf("TSQueue lock policies, single thread, %zu items\n", count);
+	policyLine<NullMtx>("NullMtx", count);
+	policyLine<AtomicMtx>("AtomicMtx", count);
+	policyLine<std::mutex>("std::mutex", count);
+	policyLine<FutexMtx>("FutexMtx", count);
+	policyLine<PI_MUTEX>("PI_MUTEX", count);
+	printf("\n");
+}
+
+// A stats counter every thread bumps: one instance behind a mutex against
+// ShardedSingleton's one per thread, added up at the end.
+struct BenchCounter
+{
+	std::mutex lock;
+	uint64_t hits = 0;
+};
+
+struct BenchShardedCounter : public ShardedSingleton<BenchShardedCounter>
+{
+	std::atomic<uint64_t> hits{0};
+};
+
+template <typename Bump>
+static void counterLine(const char *name, size_t count, size_t threads, Bump bump)
+{
+	vector<thread> workers;
+	size_t each = count / threads;
+	auto start = steady_clock::now();
+
+	for (size_t t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&]
+		{
+			for (size_t i = 0; i < each; i++)
+			{
+				bump();
+			}
+		});
+	}
+	for (auto &w : workers)
+	{
+		w.join();
+	}
+
+	duration<double> elapsed = steady_clock::now() - start;
+	printf("  %-30s %2zu threads : %8.2f Mhits/s\n", name, threads, ((each * threads) / elapsed.count()) / 1e6);
+}
+
+static void benchCounters(size_t count)
+{
+	printf("Shared stats counter, %zu hits\n", count);
+	for (size_t threads : { 1, 4 })
+	{
+		BenchCounter counter;
+		counterLine("mutex-guarded instance", count, threads,
+			[&]{ lock_guard<std::mutex> guard(counter.lock); counter.hits++; });
+		counterLine("ShardedSingleton", count, threads,
+			[]{
+				std::atomic<uint64_t> &hits = BenchShardedCounter::GetInstance()->hits;
+				hits.store(hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			});
+	}
+	uint64_t total = BenchShardedCounter::combine(uint64_t(0),
+		[](uint64_t sum, const BenchShardedCounter &counter){ return sum + counter.hits.load(std::memory_order_relaxed); });
+	printf("  (%llu hits over %zu shards)\n\n", (unsigned long long)total, BenchShardedCounter::shards());
+}
+
+int main (int argc, char *argv[])
+{
+	size_t count = (argc > 1) ? strtoul(argv[1], NULL, 0) : 2000000;
+
+	benchSPSC(count);
+	benchFan(count);
+	benchSharded(count);
+	benchPriority(count);
+	benchBatch(count);
+	benchTimers(count);
+	benchLocks(count);
+	benchReadMostly(count);
+	benchPolicies(count);
+	benchCounters(count);
+
+	return 0;
+}
@@ -2,10 +2,26 @@
 
 #include <Runable.hpp>
 #include <Singleton.hpp>
+#include <SingletonRegistry.hpp>
+#include <TimerWheel.hpp>
+#include <TSQueue.hpp>
+#include <TSSPSCQueue.hpp>
+#include <TSMPMCQueue.hpp>
+#include <TSMultiQueue.hpp>
+#include <TSShardedQueue.hpp>
 #include <stdio.h>
+#include <string.h>
 #include <poll.h>
 #include <unistd.h>
 
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::vector;
+using std::chrono::steady_clock;
+using std::chrono::nanoseconds;
+
 
 // Keep it simple here.  Declare a simple singleton, and then
 // declare a thread class that uses the singleton and does
@@ -93,8 +109,381 @@ private:
 	int _stride;
 };
 
+// Behaviour checks for the containers, TSSelect, TimerWheel and the
+// SingletonRegistry.  These run first; "TestRPE --checks" runs only these,
+// and exits non-zero if any of them failed.
+
+static int failures = 0;
+
+static void check(bool passed, const char *what, const char *file, int line)
+{
+	if (!passed)
+	{
+		printf("FAILED: %s (%s:%d)\n", what, file, line);
+		failures++;
+	}
+}
+
+#define CHECK(X)	check((X), #X, __FILE__, __LINE__)
+
+static void checkSPSC(void)
+{
+	printf("Checking TSSPSCQueue...\n");
+
+	// Everything comes out in the order it went in.
+	const size_t count = 100000;
+	TSSPSCQueue<size_t> queue(64);
+	thread producer([&]
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			queue.push(i);
+		}
+	});
+	bool ordered = true;
+	for (size_t i = 0; i < count; i++)
+	{
+		ordered = ordered && (queue.front() == i);
+		queue.pop();
+	}
+	producer.join();
+	CHECK(ordered);
+	CHECK(queue.empty());
+
+	// Drop-oldest: a full queue throws its front away to make room.
+	TSSPSCQueue<size_t> dropping(4, false);
+	for (size_t i = 0; i < 10; i++)
+	{
+		dropping.push(i);
+	}
+	CHECK(dropping.size() == 4);
+	for (size_t i = 6; i < 10; i++)
+	{
+		CHECK(dropping.front() == i);
+		dropping.pop();
+	}
+	CHECK(dropping.empty());
+}
+
+static void checkMPMC(void)
+{
+	printf("Checking TSMPMCQueue...\n");
+
+	// Two producers, two consumers: every item comes out exactly once, and
+	// each consumer sees any one producer's items in the order they went in.
+	const size_t count = 50000;
+	TSMPMCQueue<size_t> queue(64);
+	atomic<size_t> taken(0);
+	atomic<size_t> sum(0);
+	atomic<bool> ordered(true);
+	vector<thread> threads;
+	for (size_t p = 0; p < 2; p++)
+	{
+		threads.emplace_back([&, p]
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				queue.push((i << 1) | p);
+			}
+		});
+	}
+	for (size_t c = 0; c < 2; c++)
+	{
+		threads.emplace_back([&]
+		{
+			size_t next[2] = { 0, 0 };
+			size_t item;
+			while (taken.load() < (2 * count))
+			{
+				if (queue.try_pop(item))
+				{
+					if ((item >> 1) < next[item & 1])
+					{
+						ordered = false;
+					}
+					next[item & 1] = (item >> 1) + 1;
+					sum += item >> 1;
+					taken++;
+				}
+				else
+				{
+					yield();
+				}
+			}
+		});
+	}
+	for (thread &t : threads)
+	{
+		t.join();
+	}
+	CHECK(ordered);
+	CHECK(sum == (count * (count - 1)));
+	CHECK(queue.empty());
+
+	// Drop-oldest, as with TSQueue.
+	TSMPMCQueue<size_t> dropping(4, false);
+	for (size_t i = 0; i < 10; i++)
+	{
+		dropping.push(i);
+	}
+	CHECK(dropping.size() == 4);
+	for (size_t i = 6; i < 10; i++)
+	{
+		std::optional<size_t> item = dropping.try_pop();
+		CHECK(item && (*item == i));
+	}
+	CHECK(!dropping.try_pop());
+}
+
+static void checkMultiQueue(void)
+{
+	printf("Checking TSMultiQueue...\n");
+
+	// Strict mode hands out the true top, best first.
+	TSMultiQueue<int> strict(false, 4);
+	for (int i : { 5, 1, 9, 3, 7 })
+	{
+		strict.push(i);
+	}
+	bool ordered = true;
+	for (int i : { 9, 7, 5, 3, 1 })
+	{
+		ordered = ordered && (strict.pop_wait() == i);
+	}
+	CHECK(ordered);
+	CHECK(strict.empty());
+
+	// pop() takes out what front() showed, even if something's outranked
+	// it in between.
+	TSMultiQueue<int> queue(true, 1);
+	queue.push(5);
+	queue.push(3);
+	CHECK(queue.front() == 5);
+	queue.push(8);
+	queue.pop();
+	CHECK(queue.size() == 2);
+	CHECK(queue.front() == 8);
+	queue.pop();
+	CHECK(queue.front() == 3);
+	queue.pop();
+	CHECK(queue.empty());
+}
+
+static void checkClose(void)
+{
+	printf("Checking TSQueue::close()...\n");
+
+	// A producer blocked on a full queue gets woken and turned away...
+	TSQueue<int> full(1);
+	full.push(1);
+	atomic<int> pushed(-1);
+	thread producer([&] { pushed = full.push(2) ? 1 : 0; });
+	sleep_for(milliseconds(50));
+	CHECK(pushed == -1);
+	full.close();
+	producer.join();
+	CHECK(pushed == 0);
+	CHECK(!full.push(3));
+
+	// ...and consumers still get what's left before they're told it's closed.
+	std::optional<int> item = full.pop_wait();
+	CHECK(item && (*item == 1));
+	CHECK(!full.pop_wait());
+	bool threw = false;
+	try
+	{
+		full.front();
+	}
+	catch (TSQueueClosed &)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+
+	// A consumer blocked on an empty queue gets woken with nothing.
+	TSQueue<int> empty;
+	atomic<int> woke(0);
+	thread consumer([&] { woke = empty.pop_wait() ? 2 : 1; });
+	sleep_for(milliseconds(50));
+	CHECK(woke == 0);
+	empty.close();
+	consumer.join();
+	CHECK(woke == 1);
+
+	// A closed drop-oldest queue turns pushes away without dropping anything.
+	TSShardedQueue<int> sharded(2, false, 1);
+	sharded.push(1);
+	sharded.push(2);
+	sharded.close();
+	CHECK(!sharded.push(3));
+	item = sharded.try_pop();
+	CHECK(item && (*item == 1));
+}
+
+static void checkSelect(void)
+{
+	printf("Checking TSSelect...\n");
+
+	TSQueue<int> first;
+	TSQueue<int> second;
+	CHECK(TSSelect::wait_for({ &first, &second }, milliseconds(10)) == TSSelect::TIMEOUT);
+
+	// It's the queue that got the push that gets reported.
+	thread producer([&]
+	{
+		sleep_for(milliseconds(20));
+		second.push(7);
+	});
+	CHECK(TSSelect::wait_for({ &first, &second }, std::chrono::seconds(5)) == 1);
+	producer.join();
+
+	// With both ready, the one reported takes turns.
+	first.push(1);
+	int one = TSSelect::wait({ &first, &second });
+	int two = TSSelect::wait({ &first, &second });
+	CHECK((one >= 0) && (two >= 0) && (one != two));
+}
+
+// Schedules a timer for each of delays on wheel, then waits for them.
+// Returns false if any of them came early or didn't come at all.
+static bool timersOnTime(TimerWheel &wheel, const vector<milliseconds> &delays)
+{
+	atomic<size_t> fired(0);
+	atomic<bool> early(false);
+	for (milliseconds delay : delays)
+	{
+		steady_clock::time_point deadline = steady_clock::now() + delay;
+		wheel.schedule_at(deadline, [&, deadline]
+		{
+			if (steady_clock::now() < deadline)
+			{
+				early = true;
+			}
+			fired++;
+		});
+	}
+
+	steady_clock::time_point giveUp = steady_clock::now() + delays.back() + std::chrono::seconds(2);
+	while ((fired < delays.size()) && (steady_clock::now() < giveUp))
+	{
+		sleep_for(milliseconds(5));
+	}
+	return (fired == delays.size()) && !early;
+}
+
+static void checkTimerWheel(void)
+{
+	printf("Checking TimerWheel...\n");
+
+	TimerWheel wheel(milliseconds(1));
+	atomic<bool> cancelledFired(false);
+	TimerWheel::Handle handle = wheel.schedule(milliseconds(20), [&] { cancelledFired = true; });
+	CHECK(wheel.cancel(handle));
+	CHECK(!wheel.cancel(handle));
+	CHECK(timersOnTime(wheel, { milliseconds(1), milliseconds(5), milliseconds(13), milliseconds(40) }));
+	CHECK(!cancelledFired);
+	CHECK(wheel.pending() == 0);
+
+	// A nanosecond wheel only reaches 2^30 ticks, about 1.07 seconds; past
+	// that, timers get parked and cascaded back down.
+	TimerWheel fine(nanoseconds(1));
+	CHECK(timersOnTime(fine, { milliseconds(1500) }));
+}
+
+static mutex orderLock;
+static vector<std::string> constructed;
+static vector<std::string> destroyed;
+
+static void record(vector<std::string> &list, const char *name)
+{
+	lock_guard<mutex> guard(orderLock);
+	list.push_back(name);
+}
+
+class StartFirst : public RegisteredSingleton<StartFirst>
+{
+public:
+	StartFirst() { record(constructed, "first"); };
+	~StartFirst() { record(destroyed, "first"); };
+};
+
+class StartSecond : public RegisteredSingleton<StartSecond, StartFirst>
+{
+public:
+	StartSecond() { record(constructed, "second"); };
+	~StartSecond() { record(destroyed, "second"); };
+};
+
+class StartThird : public RegisteredSingleton<StartThird, StartSecond, StartFirst>
+{
+public:
+	StartThird() { record(constructed, "third"); };
+	~StartThird() { record(destroyed, "third"); };
+};
+
+class LoopTail;
+class LoopHead : public RegisteredSingleton<LoopHead, LoopTail> {};
+class LoopTail : public RegisteredSingleton<LoopTail, LoopHead> {};
+
+static void checkSingletonRegistry(void)
+{
+	printf("Checking SingletonRegistry...\n");
+
+	// Dependencies first on the way up, last on the way down.
+	SingletonRegistry::Add<StartThird>();
+	SingletonRegistry::Startup(4);
+	CHECK(constructed == vector<std::string>({ "first", "second", "third" }));
+	SingletonRegistry::Shutdown();
+	CHECK(destroyed == vector<std::string>({ "third", "second", "first" }));
+	CHECK(StartThird::GetInstance() == NULL);
+
+	// A loop is refused before anything gets built.
+	SingletonRegistry::Add<LoopHead>();
+	bool threw = false;
+	try
+	{
+		SingletonRegistry::Startup();
+	}
+	catch (std::logic_error &)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+
+	threw = false;
+	try
+	{
+		LoopHead::GetInstance();
+	}
+	catch (std::logic_error &)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+}
+
+static int runChecks(void)
+{
+	checkSPSC();
+	checkMPMC();
+	checkMultiQueue();
+	checkClose();
+	checkSelect();
+	checkTimerWheel();
+	checkSingletonRegistry();
+	printf("%s: %d failed\n\n", (failures == 0) ? "All checks passed" : "Checks FAILED", failures);
+	return failures;
+}
+
 int main (int argc, char *argv[])
 {
+	// The behaviour checks, then the demo...
+	int failed = runChecks();
+	if ((argc > 1) && (strcmp(argv[1], "--checks") == 0))
+	{
+		return (failed == 0) ? 0 : 1;
+	}
+
 	// Do the OneShot tests...
 	OneShotTest *obj = new OneShotTest();
 	obj->start();
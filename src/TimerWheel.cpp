@@ -0,0 +1,506 @@
+/*
+ * TimerWheel.cpp
+ *
+ * A hierarchical timing wheel timer service for C++, driven by a single
+ * Runable thread.
+ *
+ * This *requires* a 2017 C++ standard compliant compiler to compile and work.
+ *
+ * Copyright (c) 2024 Frank C. Earl
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.  You may add your
+ *    own copyright notice relative to your modifications, but you cannot claim
+ *    the code herein as solely your own.
+ *
+ * 2. Binary redistributions must reproduce the above copyright notice, either
+ *    in the initial output of the derived application, a "help" screen, or in
+ *    the documentation that accompanies the same.
+ *
+ * 3. Neither the name of the copyright holder nor the names of this software's
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.  Compliance with
+ *    condition 2 does not constitute a violation of this condition.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * SPECIFICALLY DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+#include <string.h>
+
+#include <stdexcept>
+
+#include <TimerWheel.hpp>
+
+using std::chrono::steady_clock;
+using std::chrono::nanoseconds;
+using std::chrono::seconds;
+using std::chrono::duration_cast;
+
+
+/**
+ * Constructor for the TimerWheel class.
+ *
+ * Sets up an empty wheel with tick 0 being now, grabs the descriptors the
+ * service thread sleeps on (Linux), and starts the service thread.
+ *
+ * @param tick The wheel's resolution.  Anything less than a nanosecond is
+ *             taken as one.
+ *
+ * @exception std::runtime_error Thrown if the timer/wakeup descriptors
+ *            couldn't be created.
+ */
+TimerWheel::TimerWheel(nanoseconds tick) :
+		_tick((tick.count() > 0) ? tick : nanoseconds(1)),
+		_start(steady_clock::now()),
+		_occupied(),
+		_current(0),
+		_armed(IDLE),
+		_pending(0),
+		_shutdown(false)
+#if defined(__linux__)
+		, _timerFD(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)),
+		_wakeFD(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+#else
+		, _poked(false)
+#endif
+{
+#if defined(__linux__)
+	if ((_timerFD < 0) || (_wakeFD < 0))
+	{
+		if (_timerFD >= 0) ::close(_timerFD);
+		if (_wakeFD >= 0) ::close(_wakeFD);
+		throw std::runtime_error("TimerWheel::TimerWheel() couldn't create its timer descriptors...");
+	}
+#endif
+
+	start();
+}
+
+
+/**
+ * Destructor for the TimerWheel class.
+ *
+ * Stops and reaps the service thread before anything it uses goes away.
+ * Timers that haven't fired yet never will.
+ */
+TimerWheel::~TimerWheel()
+{
+	// Runable's destructor would do this too, but by then we're not a
+	// TimerWheel any more and stop() wouldn't wake the thread.
+	_shutdown = true;
+	stop();
+	join();
+
+#if defined(__linux__)
+	::close(_timerFD);
+	::close(_wakeFD);
+#endif
+}
+
+
+TimerWheel::Handle TimerWheel::add(steady_clock::time_point when, TimerCallback callback, nanoseconds period)
+{
+	Handle retVal;
+	bool poke = false;
+
+	// Round the deadline UP to a tick, so we never fire early.
+	uint64_t expiry = elapsedTicks(when);
+	if (_start + (_tick * expiry) < when)
+	{
+		expiry++;
+	}
+	uint64_t periodTicks = 0;
+	if (period.count() > 0)
+	{
+		periodTicks = (period.count() + _tick.count() - 1) / _tick.count();
+	}
+
+	{
+		lock_guard<mutex> lock(_lock);
+
+		uint32_t index;
+		if (_free.empty())
+		{
+			_nodes.emplace_back();
+			index = (uint32_t) (_nodes.size() - 1);
+			_nodes[index].generation = 0;
+		}
+		else
+		{
+			index = _free.back();
+			_free.pop_back();
+			_nodes[index].generation++;
+		}
+
+		Node &node = _nodes[index];
+		node.callback = std::move(callback);
+		node.expiry = (expiry > _current) ? expiry : (_current + 1);
+		node.period = periodTicks;
+		node.active = true;
+		link(index);
+		_pending++;
+
+		// If the thread's asleep past this one, it needs to re-arm.
+		if (node.expiry < _armed)
+		{
+			_armed = node.expiry;
+			poke = true;
+		}
+
+		retVal.slot = index;
+		retVal.generation = node.generation;
+	}
+
+	if (poke)
+	{
+		wake();
+	}
+	return retVal;
+}
+
+
+bool TimerWheel::cancel(const Handle& handle)
+{
+	lock_guard<mutex> lock(_lock);
+
+	if (!handle.valid() || (handle.slot >= _nodes.size()))
+	{
+		return false;
+	}
+	Node &node = _nodes[handle.slot];
+	if (!node.active || (node.generation != handle.generation))
+	{
+		return false;
+	}
+	unlink((uint32_t) handle.slot);
+	release((uint32_t) handle.slot);
+	return true;
+}
+
+
+size_t TimerWheel::pending(void)
+{
+	lock_guard<mutex> lock(_lock);
+	return _pending;
+}
+
+
+void TimerWheel::stop()
+{
+	_run = false;
+	wake();
+}
+
+
+// Puts a node on the tail of the slot its expiry falls in, relative to where
+// the wheel is now.  Level n holds what's due in [64^n, 64^(n+1)) ticks.
+void TimerWheel::link(uint32_t index)
+{
+	Node &node = _nodes[index];
+	uint64_t delta = node.expiry - _current;
+
+	size_t level = 0;
+	while ((level < (LEVELS - 1)) && (delta >= (uint64_t(1) << (LEVEL_BITS * (level + 1)))))
+	{
+		level++;
+	}
+
+	size_t slot;
+	if (delta >= (uint64_t(1) << (LEVEL_BITS * LEVELS)))
+	{
+		// Further out than we can reach.  Park it in the top level's last
+		// slot; when that cascades, it'll land wherever it belongs by then.
+		slot = ((_current >> (LEVEL_BITS * (LEVELS - 1))) + SLOTS - 1) & (SLOTS - 1);
+	}
+	else
+	{
+		slot = (node.expiry >> (LEVEL_BITS * level)) & (SLOTS - 1);
+	}
+
+	Bucket &bucket = _buckets[(level * SLOTS) + slot];
+	node.bucket = (uint16_t) ((level * SLOTS) + slot);
+	node.prev = bucket.tail;
+	node.next = NIL;
+	if (bucket.tail == NIL)
+	{
+		bucket.head = index;
+		_occupied[level] |= (uint64_t(1) << slot);
+	}
+	else
+	{
+		_nodes[bucket.tail].next = index;
+	}
+	bucket.tail = index;
+}
+
+
+void TimerWheel::unlink(uint32_t index)
+{
+	Node &node = _nodes[index];
+	Bucket &bucket = _buckets[node.bucket];
+
+	if (node.prev == NIL)
+	{
+		bucket.head = node.next;
+	}
+	else
+	{
+		_nodes[node.prev].next = node.next;
+	}
+	if (node.next == NIL)
+	{
+		bucket.tail = node.prev;
+	}
+	else
+	{
+		_nodes[node.next].prev = node.prev;
+	}
+	if (bucket.head == NIL)
+	{
+		_occupied[node.bucket / SLOTS] &= ~(uint64_t(1) << (node.bucket % SLOTS));
+	}
+}
+
+
+// Hands a (no longer linked) node back for reuse, dropping whatever its
+// callback was holding on to.
+void TimerWheel::release(uint32_t index)
+{
+	Node &node = _nodes[index];
+	node.active = false;
+	node.callback = nullptr;
+	_free.push_back(index);
+	_pending--;
+}
+
+
+// The next tick anything happens on- a level 0 slot coming due, or a higher
+// level slot cascading down- or IDLE if there's nothing scheduled.  One
+// rotate and count-trailing-zeros per level.
+uint64_t TimerWheel::nextEvent(void)
+{
+	uint64_t retVal = IDLE;
+
+	for (size_t level = 0; level < LEVELS; level++)
+	{
+		uint64_t bits = _occupied[level];
+		if (bits == 0)
+		{
+			continue;
+		}
+
+		// Look at the slots in the order they come up, starting after this one.
+		uint64_t base = _current >> (LEVEL_BITS * level);
+		size_t first = (base + 1) & (SLOTS - 1);
+		uint64_t rotated = (bits >> first) | (bits << ((SLOTS - first) & (SLOTS - 1)));
+		uint64_t tick = (base + 1 + __builtin_ctzll(rotated)) << (LEVEL_BITS * level);
+		if (tick < retVal)
+		{
+			retVal = tick;
+		}
+	}
+	return retVal;
+}
+
+
+// Runs the wheel forward to now, cascading and collecting callbacks into
+// _firing as it goes.  Ticks where nothing happens are skipped outright.
+void TimerWheel::advance(uint64_t now)
+{
+	for (;;)
+	{
+		uint64_t next = nextEvent();
+		if (next > now)
+		{
+			break;
+		}
+		_current = next;
+
+		// Every level whose lower levels all just wrapped drops its current
+		// slot's timers down to where they now belong.
+		for (size_t level = 1; (level < LEVELS) && ((_current & ((uint64_t(1) << (LEVEL_BITS * level)) - 1)) == 0); level++)
+		{
+			size_t slot = (_current >> (LEVEL_BITS * level)) & (SLOTS - 1);
+			Bucket &bucket = _buckets[(level * SLOTS) + slot];
+			uint32_t index = bucket.head;
+			bucket = Bucket();
+			_occupied[level] &= ~(uint64_t(1) << slot);
+			while (index != NIL)
+			{
+				uint32_t following = _nodes[index].next;
+				link(index);
+				index = following;
+			}
+		}
+
+		// Then whatever's in level 0's current slot is due.
+		size_t slot = _current & (SLOTS - 1);
+		Bucket &bucket = _buckets[slot];
+		uint32_t index = bucket.head;
+		bucket = Bucket();
+		_occupied[0] &= ~(uint64_t(1) << slot);
+		while (index != NIL)
+		{
+			Node &node = _nodes[index];
+			uint32_t following = node.next;
+			if (node.period > 0)
+			{
+				_firing.push_back(node.callback);
+				node.expiry += node.period;
+				if (node.expiry <= _current)
+				{
+					// We fell behind by more than a period.  Don't try to catch up.
+					node.expiry = _current + 1;
+				}
+				link(index);
+			}
+			else
+			{
+				_firing.push_back(std::move(node.callback));
+				release(index);
+			}
+			index = following;
+		}
+	}
+
+	if (_current < now)
+	{
+		_current = now;
+	}
+}
+
+
+void TimerWheel::wake(void)
+{
+#if defined(__linux__)
+	uint64_t one = 1;
+	if (::write(_wakeFD, &one, sizeof(one)) < 0)
+	{
+		// Already poked and not yet picked up- that's all we wanted anyway.
+	}
+#else
+	{
+		lock_guard<mutex> lock(_lock);
+		_poked = true;
+	}
+	_wakeup.notify_one();
+#endif
+}
+
+
+void TimerWheel::sleepUntil(uint64_t tick)
+{
+#if defined(__linux__)
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+	if (tick != IDLE)
+	{
+		// steady_clock is CLOCK_MONOTONIC here, so its epoch is the timerfd's.
+		nanoseconds when = duration_cast<nanoseconds>((_start + (_tick * tick)).time_since_epoch());
+		spec.it_value.tv_sec = duration_cast<seconds>(when).count();
+		spec.it_value.tv_nsec = (when % seconds(1)).count();
+		if ((spec.it_value.tv_sec == 0) && (spec.it_value.tv_nsec == 0))
+		{
+			// All zeroes would disarm it instead.
+			spec.it_value.tv_nsec = 1;
+		}
+	}
+	timerfd_settime(_timerFD, TFD_TIMER_ABSTIME, &spec, NULL);
+
+	struct pollfd fdset[2];
+	memset((void*)fdset, 0, sizeof(fdset));
+	fdset[0].fd     = _timerFD;
+	fdset[0].events = POLLIN;
+	fdset[1].fd     = _wakeFD;
+	fdset[1].events = POLLIN;
+
+	if (poll(fdset, 2, -1) > 0)
+	{
+		// Drain whichever woke us, so the next poll() waits again.
+		uint64_t count;
+		for (size_t i = 0; i < 2; i++)
+		{
+			if ((fdset[i].revents & POLLIN) && (::read(fdset[i].fd, &count, sizeof(count)) < 0))
+			{
+				perror("TimerWheel::sleepUntil()");
+			}
+		}
+	}
+#else
+	std::unique_lock<mutex> lock(_lock);
+	if (tick == IDLE)
+	{
+		_wakeup.wait(lock, [&]{ return _poked; });
+	}
+	else
+	{
+		_wakeup.wait_until(lock, _start + (_tick * tick), [&]{ return _poked; });
+	}
+	_poked = false;
+#endif
+}
+
+
+uint64_t TimerWheel::elapsedTicks(steady_clock::time_point when)
+{
+	return (when > _start) ? (uint64_t) ((when - _start) / _tick) : 0;
+}
+
+
+/**
+ * The service thread.  Catches the wheel up to the clock, fires whatever
+ * came due (outside the lock), and sleeps until the next thing can.
+ */
+void TimerWheel::run(void)
+{
+	while (_run && !_shutdown)
+	{
+		uint64_t next;
+		{
+			lock_guard<mutex> lock(_lock);
+			advance(elapsedTicks(steady_clock::now()));
+			next = nextEvent();
+			_armed = next;
+		}
+
+		for (TimerCallback &callback : _firing)
+		{
+			try
+			{
+				callback();
+			}
+			catch (std::exception& e)
+			{
+				printf("TimerWheel : %s\n", e.what());
+			}
+		}
+		_firing.clear();
+
+		if (_run && !_shutdown)
+		{
+			sleepUntil(next);
+		}
+	}
+}